@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <iostream>
 #include "draw.h"
+#include "Profiler.hpp"
+#include "Replay.hpp"
 
 #define RENDER_COUNT 3
 enum Renderer { RENDER_OPENGL = 0, RENDER_BRENSENHAM, RENDER_MIDPOINT };
@@ -296,6 +298,8 @@ void draw_stalker_line() {
 }
 
 void display() {
+  PROFILE_FRAME();
+  PROFILE_SCOPE("display");
   //Clear all pixels
   glClear(GL_COLOR_BUFFER_BIT);
 
@@ -418,14 +422,15 @@ int main(int argc, char *argv[]) {
   //Create the window
   glutCreateWindow("CS 460");
   init();
+  replay::init();
 
-  glutDisplayFunc(display);
-  glutIdleFunc(display);
+  replay::display_func(display);
+  replay::idle_func(display);
   glutReshapeFunc(reshape);
-  glutMouseFunc(mouse_handler);
-  glutMotionFunc(mouse_motion_handler);
-  glutPassiveMotionFunc(mouse_motion_handler);
-  glutKeyboardFunc(keyboard_handler);
+  replay::mouse_func(mouse_handler);
+  replay::motion_func(mouse_motion_handler);
+  replay::passive_motion_func(mouse_motion_handler);
+  replay::keyboard_func(keyboard_handler);
 
   //Enter the GLUT event loop
   glutMainLoop();
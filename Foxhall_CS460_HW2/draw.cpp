@@ -1,4 +1,5 @@
 #include "draw.hpp"
+#include "Profiler.hpp"
 
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
@@ -50,6 +51,7 @@ void LoopDrawing::draw() {
 
 BlobDrawing::BlobDrawing(const Point2d& start):
   Drawing{start} {
+  PROFILE_SCOPE("BlobDrawing fill");
   unsigned char pixel[4], base_color[4];
   int width = glutGet(GLUT_WINDOW_WIDTH);
   int height = glutGet(GLUT_WINDOW_HEIGHT);
@@ -2,6 +2,8 @@
 #include <OpenGL/glu.h>
 #include <GLUT/glut.h>
 #include "draw.hpp"
+#include "Profiler.hpp"
+#include "Replay.hpp"
 
 #include <stdlib.h>
 #include <iostream>
@@ -102,6 +104,7 @@ void clip(const std::list<Point2d>& clip_window) {
 }
 
 void map_viewport() {
+  PROFILE_SCOPE("map_viewport");
   // Draw painter's drawings that lie in the clipping window
   viewport_painter.delete_drawings();
   std::list<Point2d> bounds{
@@ -138,6 +141,8 @@ void map_viewport() {
 }
 
 void display() {
+  PROFILE_FRAME();
+  PROFILE_SCOPE("display");
   //Clear all pixels
   glClear(GL_COLOR_BUFFER_BIT);
 
@@ -288,14 +293,15 @@ int main(int argc, char *argv[]) {
   //Create the window
   glutCreateWindow("CS 460");
   init();
+  replay::init();
 
-  glutDisplayFunc(display);
-  glutIdleFunc(display);
+  replay::display_func(display);
+  replay::idle_func(display);
   glutReshapeFunc(reshape);
-  glutMouseFunc(mouse_handler);
-  glutMotionFunc(mouse_motion_handler);
-  glutPassiveMotionFunc(mouse_motion_handler);
-  glutKeyboardFunc(keyboard_handler);
+  replay::mouse_func(mouse_handler);
+  replay::motion_func(mouse_motion_handler);
+  replay::passive_motion_func(mouse_motion_handler);
+  replay::keyboard_func(keyboard_handler);
 
   //Enter the GLUT event loop
   glutMainLoop();
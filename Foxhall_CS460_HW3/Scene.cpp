@@ -0,0 +1,399 @@
+#include "Scene.hpp"
+
+#include <OpenGL/gl.h>
+
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <math.h>
+
+// Mat4
+Mat4::Mat4() {
+  for (int i = 0; i < 16; i++) {
+    m[i] = (i % 5 == 0) ? 1.0 : 0.0;
+  }
+}
+
+Mat4 Mat4::translate(double x, double y, double z) {
+  Mat4 t;
+  t.m[12] = x;
+  t.m[13] = y;
+  t.m[14] = z;
+  return t;
+}
+
+// Same matrix glRotated builds
+Mat4 Mat4::rotate(double deg, double x, double y, double z) {
+  Mat4 r;
+  double len = sqrt(x*x + y*y + z*z);
+  if (len == 0) {
+    return r;
+  }
+  x /= len; y /= len; z /= len;
+  double rad = deg * M_PI / 180.0;
+  double c = cos(rad), s = sin(rad), t = 1 - c;
+  r.m[0] = x*x*t + c;   r.m[4] = x*y*t - z*s; r.m[8] = x*z*t + y*s;
+  r.m[1] = y*x*t + z*s; r.m[5] = y*y*t + c;   r.m[9] = y*z*t - x*s;
+  r.m[2] = x*z*t - y*s; r.m[6] = y*z*t + x*s; r.m[10] = z*z*t + c;
+  return r;
+}
+
+Mat4 Mat4::scale(double x, double y, double z) {
+  Mat4 s;
+  s.m[0] = x;
+  s.m[5] = y;
+  s.m[10] = z;
+  return s;
+}
+
+Mat4 Mat4::operator*(const Mat4& o) const {
+  Mat4 r;
+  for (int col = 0; col < 4; col++) {
+    for (int row = 0; row < 4; row++) {
+      double sum = 0;
+      for (int k = 0; k < 4; k++) {
+        sum += m[row + 4*k] * o.m[k + 4*col];
+      }
+      r.m[row + 4*col] = sum;
+    }
+  }
+  return r;
+}
+
+// Mesh
+// Ring j of a cylinder sits at z = height*j/stacks, same as gluCylinder
+Mesh Mesh::cylinder(double base, double top, double height, int slices, int stacks, bool fill) {
+  Mesh mesh;
+  for (int j = 0; j <= stacks; j++) {
+    double t = static_cast<double>(j) / stacks;
+    double r = base + (top - base)*t;
+    for (int i = 0; i < slices; i++) {
+      double angle = 2*M_PI*i / slices;
+      mesh.verts.push_back(r*sin(angle));
+      mesh.verts.push_back(r*cos(angle));
+      mesh.verts.push_back(height*t);
+    }
+  }
+
+  for (int j = 0; j <= stacks; j++) {
+    for (int i = 0; i < slices; i++) {
+      GLuint a = j*slices + i;
+      GLuint b = j*slices + (i+1) % slices;
+      if (fill) {
+        if (j < stacks) {
+          GLuint c = a + slices, d = b + slices;
+          GLuint quad[] = {a, b, c, c, b, d};
+          mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+      } else {
+        // Ring segment, then the segment up the side
+        mesh.indices.push_back(a);
+        mesh.indices.push_back(b);
+        if (j < stacks) {
+          mesh.indices.push_back(a);
+          mesh.indices.push_back(a + slices);
+        }
+      }
+    }
+  }
+  mesh.mode = fill ? GL_TRIANGLES : GL_LINES;
+  return mesh;
+}
+
+// Poles on the z axis, same as gluSphere
+Mesh Mesh::sphere(double radius, int slices, int stacks, bool fill) {
+  Mesh mesh;
+  for (int j = 0; j <= stacks; j++) {
+    double rho = M_PI*j / stacks;
+    for (int i = 0; i <= slices; i++) {
+      double theta = 2*M_PI*i / slices;
+      mesh.verts.push_back(radius*sin(rho)*sin(theta));
+      mesh.verts.push_back(radius*sin(rho)*cos(theta));
+      mesh.verts.push_back(radius*cos(rho));
+    }
+  }
+
+  for (int j = 0; j < stacks; j++) {
+    for (int i = 0; i < slices; i++) {
+      GLuint a = j*(slices+1) + i;
+      GLuint b = a + 1;
+      GLuint c = a + slices + 1, d = c + 1;
+      if (fill) {
+        GLuint quad[] = {a, c, b, b, c, d};
+        mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+      } else {
+        GLuint lines[] = {a, b, a, c};
+        mesh.indices.insert(mesh.indices.end(), lines, lines + 4);
+      }
+    }
+  }
+  mesh.mode = fill ? GL_TRIANGLES : GL_LINES;
+  return mesh;
+}
+
+// Lines across the xz plane from -size to size
+Mesh Mesh::grid(double size, int divisions) {
+  Mesh mesh;
+  for (int i = 0; i <= divisions; i++) {
+    GLfloat d = -size + 2*size*i / divisions;
+    GLfloat lines[] = {
+      d, 0, static_cast<GLfloat>(-size), d, 0, static_cast<GLfloat>(size),
+      static_cast<GLfloat>(-size), 0, d, static_cast<GLfloat>(size), 0, d,
+    };
+    mesh.verts.insert(mesh.verts.end(), lines, lines + 12);
+  }
+  for (GLuint i = 0; i < mesh.verts.size() / 3; i++) {
+    mesh.indices.push_back(i);
+  }
+  mesh.mode = GL_LINES;
+  return mesh;
+}
+
+// Scene
+Scene::Scene(const std::string& filename): name_{filename} {
+  auto start = std::chrono::steady_clock::now();
+
+  std::ifstream file(filename);
+  if (!file) {
+    throw std::runtime_error("Could not open scene " + filename);
+  }
+  std::string line;
+  int lineno = 0;
+  while (std::getline(file, line)) {
+    lineno++;
+    auto comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word) {
+      tokens_.push_back(Token{word, lineno});
+    }
+  }
+
+  parse(program_, false);
+  tokens_.clear();
+  tokens_.shrink_to_fit();
+  bake();
+
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  std::cout << "Loaded " << filename << ": " << items_.size() << " objects, "
+            << meshes_.size() << " meshes in " << elapsed.count() << " ms" << std::endl;
+}
+
+const Scene::Token& Scene::next() {
+  if (pos_ >= tokens_.size()) {
+    throw std::runtime_error(name_ + ": unexpected end of file");
+  }
+  return tokens_[pos_++];
+}
+
+double Scene::number() {
+  const Token& tok = next();
+  std::istringstream in(tok.text);
+  double d;
+  if (!(in >> d)) {
+    throw std::runtime_error(name_ + ":" + std::to_string(tok.line) + ": expected a number, got " + tok.text);
+  }
+  return d;
+}
+
+int Scene::count() {
+  double d = number();
+  const Token& tok = tokens_[pos_ - 1];
+  if (!(d >= 1 && d <= INT_MAX) || d != static_cast<int>(d)) {
+    throw std::runtime_error(name_ + ":" + std::to_string(tok.line) + ": expected a count of at least 1, got " +
+                             tok.text);
+  }
+  return static_cast<int>(d);
+}
+
+void Scene::parse(std::vector<Op>& ops, bool nested) {
+  while (pos_ < tokens_.size()) {
+    const Token& tok = next();
+    const std::string& word = tok.text;
+    Op op{};
+
+    if (word == "}") {
+      if (!nested) {
+        throw std::runtime_error(name_ + ":" + std::to_string(tok.line) + ": unmatched }");
+      }
+      return;
+    } else if (word == "{") {
+      op.code = OP_PUSH;
+      ops.push_back(op);
+      parse(ops, true);
+      op.code = OP_POP;
+      ops.push_back(op);
+    } else if (word == "mesh") {
+      std::string mesh_name = next().text;
+      std::string kind = next().text;
+      Mesh mesh;
+      if (kind == "cylinder") {
+        double base = number(), top = number(), height = number();
+        int slices = count(), stacks = count();
+        mesh = Mesh::cylinder(base, top, height, slices, stacks, next().text == "fill");
+      } else if (kind == "sphere") {
+        double radius = number();
+        int slices = count(), stacks = count();
+        mesh = Mesh::sphere(radius, slices, stacks, next().text == "fill");
+      } else if (kind == "grid") {
+        double size = number();
+        mesh = Mesh::grid(size, count());
+      } else {
+        throw std::runtime_error(name_ + ":" + std::to_string(tok.line) + ": unknown primitive " + kind);
+      }
+      mesh_names_[mesh_name] = meshes_.size();
+      meshes_.push_back(std::move(mesh));
+    } else if (word == "color") {
+      op.code = OP_COLOR;
+      op.args[0] = number(); op.args[1] = number(); op.args[2] = number();
+      ops.push_back(op);
+    } else if (word == "width") {
+      op.code = OP_WIDTH;
+      op.args[0] = number();
+      ops.push_back(op);
+    } else if (word == "translate") {
+      op.code = OP_MULT;
+      double x = number(), y = number(), z = number();
+      op.mat = Mat4::translate(x, y, z);
+      ops.push_back(op);
+    } else if (word == "rotate") {
+      op.code = OP_MULT;
+      double deg = number(), x = number(), y = number(), z = number();
+      op.mat = Mat4::rotate(deg, x, y, z);
+      ops.push_back(op);
+    } else if (word == "turn") {
+      op.code = OP_TURN;
+      op.args[0] = number(); op.args[1] = number(); op.args[2] = number(); op.args[3] = number();
+      ops.push_back(op);
+    } else if (word == "scale") {
+      op.code = OP_MULT;
+      double x = number(), y = number(), z = number();
+      op.mat = Mat4::scale(x, y, z);
+      ops.push_back(op);
+    } else if (word == "draw") {
+      const Token& mesh_tok = next();
+      auto it = mesh_names_.find(mesh_tok.text);
+      if (it == mesh_names_.end()) {
+        throw std::runtime_error(name_ + ":" + std::to_string(mesh_tok.line) + ": no mesh named " + mesh_tok.text);
+      }
+      op.code = OP_DRAW;
+      op.mesh = it->second;
+      ops.push_back(op);
+    } else if (word == "repeat") {
+      int n = number();
+      double x = number(), y = number(), z = number();
+      if (next().text != "{") {
+        throw std::runtime_error(name_ + ":" + std::to_string(tok.line) + ": repeat needs a { block }");
+      }
+      // Unrolled here so drawing never has to know about it
+      std::vector<Op> block;
+      parse(block, true);
+      for (int k = 0; k < n; k++) {
+        op.code = OP_PUSH;
+        ops.push_back(op);
+        op.code = OP_MULT;
+        op.mat = Mat4::translate(k*x, k*y, k*z);
+        ops.push_back(op);
+        ops.insert(ops.end(), block.begin(), block.end());
+        op.code = OP_POP;
+        ops.push_back(op);
+      }
+    } else {
+      throw std::runtime_error(name_ + ":" + std::to_string(tok.line) + ": unknown statement " + word);
+    }
+  }
+
+  if (nested) {
+    throw std::runtime_error(name_ + ": missing }");
+  }
+}
+
+// Flattens the program into world matrices, only redone when the turn angle changes
+void Scene::bake() {
+  struct State {
+    Mat4 mat;
+    GLfloat color[3];
+    GLfloat width;
+  };
+  std::vector<State> stack;
+  State cur{Mat4{}, {1.0, 1.0, 1.0}, 1.0};
+
+  items_.clear();
+  for (auto& op: program_) {
+    switch (op.code) {
+    case OP_PUSH:
+      stack.push_back(cur);
+      break;
+    case OP_POP:
+      cur = stack.back();
+      stack.pop_back();
+      break;
+    case OP_MULT:
+      cur.mat = cur.mat * op.mat;
+      break;
+    case OP_TURN:
+      cur.mat = cur.mat * Mat4::rotate(turn_ + op.args[0], op.args[1], op.args[2], op.args[3]);
+      break;
+    case OP_COLOR:
+      for (int i = 0; i < 3; i++) {
+        cur.color[i] = op.args[i];
+      }
+      break;
+    case OP_WIDTH:
+      cur.width = op.args[0];
+      break;
+    case OP_DRAW: {
+      DrawItem item;
+      item.mesh = op.mesh;
+      for (int i = 0; i < 3; i++) {
+        item.color[i] = cur.color[i];
+      }
+      item.width = cur.width;
+      item.world = cur.mat;
+      items_.push_back(item);
+      break;
+    }
+    }
+  }
+  dirty_ = false;
+}
+
+void Scene::set_turn(double deg) {
+  if (deg != turn_) {
+    turn_ = deg;
+    dirty_ = true;
+  }
+}
+
+void Scene::draw() {
+  if (dirty_) {
+    bake();
+  }
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  int bound = -1;
+  GLfloat width = -1;
+  for (auto& item: items_) {
+    const Mesh& mesh = meshes_[item.mesh];
+    if (item.mesh != bound) {
+      glVertexPointer(3, GL_FLOAT, 0, mesh.verts.data());
+      bound = item.mesh;
+    }
+    if (item.width != width) {
+      glLineWidth(item.width);
+      width = item.width;
+    }
+    glColor3fv(item.color);
+    glPushMatrix();
+    glMultMatrixd(item.world.m);
+    glDrawElements(mesh.mode, mesh.indices.size(), GL_UNSIGNED_INT, mesh.indices.data());
+    glPopMatrix();
+  }
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
@@ -0,0 +1,98 @@
+#ifndef SCENE_HPP_
+#define SCENE_HPP_
+
+#include <OpenGL/gl.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Column major, the way glMultMatrixd wants it
+struct Mat4 {
+  GLdouble m[16];
+
+  Mat4();
+  static Mat4 translate(double x, double y, double z);
+  static Mat4 rotate(double deg, double x, double y, double z);
+  static Mat4 scale(double x, double y, double z);
+  Mat4 operator*(const Mat4&) const;
+};
+
+// Tessellated once at load time, replaces gluCylinder/gluSphere every frame
+struct Mesh {
+  std::vector<GLfloat> verts;
+  std::vector<GLuint> indices;
+  GLenum mode;
+
+  static Mesh cylinder(double base, double top, double height, int slices, int stacks, bool fill);
+  static Mesh sphere(double radius, int slices, int stacks, bool fill);
+  static Mesh grid(double size, int divisions);
+};
+
+/*
+  Scene files are read a statement at a time, '#' starts a comment:
+
+  mesh <name> cylinder <base> <top> <height> <slices> <stacks> <line|fill>
+  mesh <name> sphere <radius> <slices> <stacks> <line|fill>
+  mesh <name> grid <size> <divisions>
+                              slices, stacks and divisions are whole, >= 1
+  color <r> <g> <b>
+  width <w>
+  translate <x> <y> <z>
+  rotate <deg> <x> <y> <z>
+  turn <deg> <x> <y> <z>      rotate by the g/G angle plus deg
+  scale <x> <y> <z>
+  draw <name>
+  { ... }                     save and restore transform, color and width
+  repeat <n> <x> <y> <z> { ... }  n copies, each moved by (x, y, z)
+*/
+class Scene {
+public:
+  Scene() = default;
+  Scene(const std::string& filename);
+
+  void draw();
+  void set_turn(double deg);
+  const std::string& name() const { return name_; }
+  std::size_t size() const { return items_.size(); }
+private:
+  enum OpCode { OP_PUSH, OP_POP, OP_MULT, OP_TURN, OP_COLOR, OP_WIDTH, OP_DRAW };
+  struct Op {
+    OpCode code;
+    Mat4 mat;
+    GLdouble args[4];
+    int mesh;
+  };
+  struct DrawItem {
+    int mesh;
+    GLfloat color[3];
+    GLfloat width;
+    Mat4 world;
+  };
+
+  struct Token {
+    std::string text;
+    int line;
+  };
+
+  void parse(std::vector<Op>&, bool nested);
+  const Token& next();
+  double number();
+  // A whole number of at least 1, for slices, stacks and divisions
+  int count();
+  void bake();
+
+  std::string name_;
+  std::vector<Mesh> meshes_;
+  std::map<std::string, int> mesh_names_;
+  std::vector<Op> program_;
+  std::vector<DrawItem> items_;
+  double turn_ = 0.0;
+  bool dirty_ = true;
+
+  // Only alive while loading
+  std::vector<Token> tokens_;
+  std::size_t pos_ = 0;
+};
+
+#endif
@@ -2,9 +2,15 @@
 #include <OpenGL/glu.h>
 #include <GLUT/glut.h>
 
+#include "Scene.hpp"
+#include "Profiler.hpp"
+#include "Replay.hpp"
+
 #include <iostream>
 #include <assert.h>
 #include <math.h>
+#include <stdexcept>
+#include <vector>
 
 namespace {
   double camera_x = 0.0;
@@ -19,8 +25,8 @@ namespace {
   double lever_rot = 0.0;
   GLsizei width;
   GLsizei height;
-  enum Scene { SCENE_CYLINDER, SCENE_LEVER };
-  Scene current_scene = SCENE_CYLINDER;
+  std::vector<Scene> scenes;
+  std::size_t current_scene = 0;
 }
 
 void reset_camera() {
@@ -38,11 +44,8 @@ void reset_camera() {
 
 void next_scene() {
   reset_camera();
-  if (current_scene == SCENE_CYLINDER) {
-    current_scene = SCENE_LEVER;
-  } else {
-    current_scene = SCENE_CYLINDER;
-  }
+  current_scene = (current_scene + 1) % scenes.size();
+  scenes[current_scene].set_turn(lever_rot);
 }
 
 void init() {
@@ -52,111 +55,9 @@ void init() {
   reset_camera();
 }
 
-void draw_ground() {
-  glLineWidth(1);
-  glColor3f(1.0, 1.0, 1.0);
-  glBegin(GL_LINES);
-  for(float i =-1; i<=1; i += 0.1) {
-    glVertex3f(i*100.f, -10.f, -100.f);
-    glVertex3f(i*100.f, -10.f, 100.f);
-  }
-  for(float j =-1; j<=1; j += 0.1) {
-    glVertex3f(-100.f, -10.f, j*100.f);
-    glVertex3f(100.f, -10.f, j*100.f);
-  }
-  glEnd();
-}
-
-void draw_cylinder() {
-  glPushMatrix();
-  //glRotatef(rx, 1, 0, 0);
-  //glRotatef(ry, 0, 1, 0);
-  //glRotatef(rz, 0, 0, 1);
-
-  // Draw ground
-  draw_ground();
-
-  // Draw cylinder
-  GLUquadricObj *quad = gluNewQuadric();
-  gluQuadricDrawStyle(quad, GLU_LINE);
-  glColor3f(1.0, 0.0, 0.0);
-  glLineWidth(2.0);
-  gluCylinder(quad, 5, 5, 30, 20, 10);
-  gluDeleteQuadric(quad);
-
-  glPopMatrix();
-}
-
-void draw_lever() {
-  glPushMatrix();
-  //glRotatef(rx, 1, 0, 0);
-  //glRotatef(ry, 0, 1, 0);
-  //glRotatef(rz, 0, 0, 1);
-
-  // Draw ground
-  draw_ground();
-
-  GLUquadricObj *quad = gluNewQuadric();
-  gluQuadricDrawStyle(quad, GLU_FILL);
-
-  glPushMatrix();
-  glRotated(lever_rot, 0, 1, 0); // rotation for b2
-  // Position s1
-  glRotated(90, 1, 0, 0);
-  // Draw s1
-  glColor3f(0.0, 0.0, 1.0);
-  gluCylinder(quad, 1, 1, 20, 10, 10);
-  // Position b2
-  // Draw b2
-  glColor3f(0.0, 1.0, 1.0);
-  gluSphere(quad, 2, 10, 10);
-  glPopMatrix();
-
-
-  // left arm
-  glPushMatrix();
-  glRotated(-90+lever_rot, 0, 1, 0);
-  glColor3f(0.0, 0.0, 1.0);
-  gluCylinder(quad, 1, 1, 10, 10, 10); // s2
-  glTranslated(0.0, 0.0, 10.0);
-  glRotated(90, 0, 1, 0);
-  glRotated(lever_rot+90, 1, 0, 0);
-  glColor3f(0.0, 1.0, 1.0);
-  gluSphere(quad, 1.5, 10, 10); // b1
-  glColor3f(0.0, 0.0, 1.0);
-  gluCylinder(quad, 0, 1, 10, 10, 10); // s2
-  glTranslated(0, 0, 10);
-  glColor3f(0.0, 1.0, 1.0);
-  gluSphere(quad, 3, 10, 10); // b1
-  glPopMatrix();
-
-  // right arm
-  glPushMatrix();
-  glRotated(90+lever_rot, 0, 1, 0);
-  glColor3f(0.0, 0.0, 1.0);
-  gluCylinder(quad, 1, 1, 10, 10, 10); // s2
-  glTranslated(0.0, 0.0, 10.0);
-  glRotated(90, 0, 1, 0);
-  glRotated(lever_rot+90, 1, 0, 0);
-  glColor3f(0.0, 1.0, 1.0);
-  gluSphere(quad, 1.5, 10, 10); // b1
-  glColor3f(0.0, 0.0, 1.0);
-  gluCylinder(quad, 0, 1, 10, 10, 10); // s2
-  glTranslated(0, 0, 10);
-  glColor3f(0.0, 1.0, 1.0);
-  gluSphere(quad, 3, 10, 10); // b1
-  glPopMatrix();
-
-  gluDeleteQuadric(quad);
-  glPopMatrix();
-}
-
 void draw_scene() {
-  if (current_scene == SCENE_CYLINDER) {
-    draw_cylinder();
-  } else if (current_scene == SCENE_LEVER) {
-    draw_lever();
-  }
+  PROFILE_SCOPE("draw_scene");
+  scenes[current_scene].draw();
 }
 
 void draw_perpective(float x, float y, float z, float u, float v, float n) {
@@ -188,6 +89,8 @@ void draw_side_views() {
 }
 
 void display() {
+  PROFILE_FRAME();
+  PROFILE_SCOPE("display");
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   glColor3f(1.0, 1.0, 1.0);
@@ -286,9 +189,12 @@ void keyboard_handler(unsigned char key, int, int) {
       break;
     case 'g':
       lever_rot += 10;
+      scenes[current_scene].set_turn(lever_rot);
       break;
     case 'G':
       lever_rot -= 10;
+      scenes[current_scene].set_turn(lever_rot);
+      break;
     default:
       break;
   }
@@ -350,12 +256,27 @@ int main(int argc, char *argv[]) {
   //Create the window
   glutCreateWindow("CS 460");
   init();
+  replay::init();
+
+  // Whatever glutInit left behind are scene files
+  std::vector<std::string> files(argv + 1, argv + argc);
+  if (files.empty()) {
+    files = {"scenes/cylinder.scene", "scenes/lever.scene"};
+  }
+  try {
+    for (auto& f: files) {
+      scenes.push_back(Scene(f));
+    }
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
 
-  glutDisplayFunc(display);
-  glutIdleFunc(display);
+  replay::display_func(display);
+  replay::idle_func(display);
   glutReshapeFunc(reshape);
-  glutKeyboardFunc(keyboard_handler);
-  glutSpecialFunc(special_key_handler);
+  replay::keyboard_func(keyboard_handler);
+  replay::special_func(special_key_handler);
 
   //Enter the GLUT event loop
   glutMainLoop();
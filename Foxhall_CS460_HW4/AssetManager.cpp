@@ -0,0 +1,62 @@
+#include "AssetManager.hpp"
+
+#include <iostream>
+#include <sstream>
+
+AssetManager::AssetManager(Clock::time_point start): start_{start} {}
+
+AssetManager::~AssetManager() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    jobs_.clear();
+  }
+  wake_.notify_one();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+double AssetManager::elapsed_ms() const {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+}
+
+// The thread starts with the first job, so a manager nobody uses costs nothing
+void AssetManager::enqueue(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+    if (!worker_.joinable()) {
+      worker_ = std::thread(&AssetManager::run, this);
+    }
+  }
+  wake_.notify_one();
+}
+
+void AssetManager::finished(const std::string& name, double begin_ms, const char *error) {
+  double now = elapsed_ms();
+  // One write so lines from the two threads don't interleave
+  std::ostringstream line;
+  if (error) {
+    line << "Failed to load " << name << " after " << now - begin_ms << " ms: " << error << "\n";
+  } else {
+    line << "Asset " << name << " took " << now - begin_ms << " ms, ready " << now << " ms after startup\n";
+  }
+  std::cout << line.str() << std::flush;
+}
+
+void AssetManager::run() {
+  for (;;) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef ASSET_MANAGER_H_
+#define ASSET_MANAGER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Builds assets one at a time on a background thread, in the order they're
+// asked for. Results come back as futures so the GL thread can check on
+// them every frame without blocking. Logs how long each took and how long
+// after `start` it was ready.
+class AssetManager {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit AssetManager(Clock::time_point start = Clock::now());
+    // Waits for the asset being built, drops the ones still queued
+    ~AssetManager();
+    AssetManager(const AssetManager&) = delete;
+    AssetManager& operator=(const AssetManager&) = delete;
+
+    // Queues `make`. The future holds what it returned, or rethrows what it threw.
+    template <class T>
+    std::shared_future<std::shared_ptr<T>> load(const std::string& name, std::function<std::shared_ptr<T>()> make) {
+      auto task = std::make_shared<std::packaged_task<std::shared_ptr<T>()>>([this, name, make] {
+        double begin = elapsed_ms();
+        try {
+          auto result = make();
+          finished(name, begin, nullptr);
+          return result;
+        } catch (const std::exception& e) {
+          finished(name, begin, e.what());
+          throw;
+        }
+      });
+      std::shared_future<std::shared_ptr<T>> future = task->get_future().share();
+      enqueue([task] { (*task)(); });
+      return future;
+    }
+
+    // True once `future` holds a value or an exception
+    template <class T>
+    static bool ready(const std::shared_future<T>& future) {
+      return future.valid() && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    double elapsed_ms() const;
+  private:
+    void enqueue(std::function<void()> job);
+    void finished(const std::string& name, double begin_ms, const char *error);
+    void run();
+
+    Clock::time_point start_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_ = false;
+    std::thread worker_;
+};
+
+#endif
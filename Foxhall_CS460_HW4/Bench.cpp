@@ -0,0 +1,810 @@
+#include "Bench.hpp"
+#include "AssetManager.hpp"
+#include "ObjLoader.hpp"
+#include "GeoObject.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "CompactMesh.hpp"
+#include "LodChain.hpp"
+#include "Bvh.hpp"
+#include "SoftRaster.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+
+namespace {
+  // Best of a few runs, in milliseconds
+  template <class F>
+  double time_ms(F f, int runs = 3) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+      best = std::min(best, elapsed.count());
+    }
+    return best;
+  }
+
+  // Torus made of quads with texcoords and normals, about `triangles`
+  // triangles. "plain" writes only v and triangle f lines.
+  int make_obj(int argc, char *argv[]) {
+    if (argc < 2) {
+      return -1;
+    }
+    long triangles = std::atol(argv[1]);
+    bool plain = argc > 2 && std::string(argv[2]) == "plain";
+    int rings = std::max(3, static_cast<int>(sqrt(triangles / 2.0)));
+    int sides = std::max(3, static_cast<int>(triangles / 2 / rings));
+    std::ofstream out(argv[0]);
+    out << "# torus " << rings << "x" << sides << "\n";
+    for (int i = 0; i < rings; i++) {
+      double u = 2*M_PI*i / rings;
+      for (int j = 0; j < sides; j++) {
+        double v = 2*M_PI*j / sides;
+        double nx = cos(u)*cos(v), ny = sin(u)*cos(v), nz = sin(v);
+        out << "v " << 3*cos(u) + nx << " " << 3*sin(u) + ny << " " << nz << "\n";
+        if (!plain) {
+          out << "vt " << static_cast<double>(i) / rings << " " << static_cast<double>(j) / sides << "\n"
+              << "vn " << nx << " " << ny << " " << nz << "\n";
+        }
+      }
+    }
+    for (int i = 0; i < rings; i++) {
+      for (int j = 0; j < sides; j++) {
+        int a = i*sides + j + 1;
+        int b = i*sides + (j+1) % sides + 1;
+        int c = ((i+1) % rings)*sides + (j+1) % sides + 1;
+        int d = ((i+1) % rings)*sides + j + 1;
+        if (plain) {
+          out << "f " << a << " " << b << " " << c << "\nf " << a << " " << c << " " << d << "\n";
+        } else {
+          out << "f " << a << "/" << a << "/" << a << " " << b << "/" << b << "/" << b << " "
+              << c << "/" << c << "/" << c << " " << d << "/" << d << "/" << d << "\n";
+        }
+      }
+    }
+    std::cout << "Wrote " << argv[0] << ": " << rings*sides << " verts, " << 2*rings*sides << " triangles" << std::endl;
+    return 0;
+  }
+
+  // The loader GeoObject used to have, for comparison. It only knows plain
+  // v and triangle f lines, anything else sets failbit and used to spin on eof()
+  std::size_t legacy_load(const char *filename) {
+    std::ifstream file(filename);
+    std::string leader;
+    double a, b, c;
+    int x, y, z;
+    std::size_t faces = 0;
+    std::vector<double> verts;
+    while (!file.eof()) {
+      file >> leader;
+      if (leader == "v") {
+        file >> a >> b >> c;
+        verts.push_back(a); verts.push_back(b); verts.push_back(c);
+      } else if (leader == "f") {
+        file >> x >> y >> z;
+        faces++;
+      }
+      if (file.fail()) {
+        break;
+      }
+    }
+    return faces;
+  }
+
+  int obj(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    unsigned max_threads = argc > 1 ? std::atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    ObjMesh mesh = load_obj(argv[0], 1);
+    double mb = mesh.bytes / 1e6;
+    std::cout << argv[0] << ": " << mb << " MB, " << mesh.positions.size() / 3 << " verts, "
+              << mesh.triangle_count() << " triangles" << std::endl;
+
+    for (unsigned t = 1; t <= max_threads; t *= 2) {
+      double ms = time_ms([&] { load_obj(argv[0], t); });
+      std::cout << "  mmap loader, " << t << " thread(s): " << ms << " ms, " << mb / (ms / 1000) << " MB/s" << std::endl;
+    }
+    if (mb < 50) {
+      double ms = time_ms([&] { legacy_load(argv[0]); }, 1);
+      std::cout << "  ifstream loader: " << ms << " ms, " << mb / (ms / 1000) << " MB/s" << std::endl;
+    }
+    return 0;
+  }
+
+  int cache(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    std::remove(mesh_cache_path(argv[0]).c_str());
+    double cold = time_ms([&] { GeoObject obj(argv[0]); }, 1);
+    double warm = time_ms([&] { GeoObject obj(argv[0]); }, 5);
+    std::cout << "  parse + write cache: " << cold << " ms\n"
+              << "  load from cache: " << warm << " ms (" << cold / warm << "x)" << std::endl;
+    return 0;
+  }
+
+  int cull(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    GeoObject obj(argv[0]);
+    const float *lo = obj.bounds_min(), *hi = obj.bounds_max();
+    // About where the teapot scene's camera sits in model space
+    float distance = 20 / 3.0f;
+    float dirs[][3] = {{0, 0, 1}, {1, 0, 0}, {0, 1, 0}, {0.577f, 0.577f, 0.577f}};
+    const char *modes[] = {"all", "front", "silhouette"};
+    for (auto& d: dirs) {
+      float eye[3];
+      for (int k = 0; k < 3; k++) {
+        eye[k] = (lo[k] + hi[k]) / 2 + distance * d[k];
+      }
+      std::cout << "  eye " << d[0] << "," << d[1] << "," << d[2] << ":";
+      for (int mode = 0; mode < 3; mode++) {
+        std::size_t lines = obj.edge_count();
+        double ms = 0;
+        if (mode != GeoObject::WIRE_ALL) {
+          ms = time_ms([&] { lines = obj.classify(eye, static_cast<GeoObject::WireMode>(mode)); });
+        }
+        std::cout << "  " << modes[mode] << " " << lines << " (" << 100.0 * lines / obj.edge_count() << "%, "
+                  << ms << " ms)";
+      }
+      std::cout << "\n";
+    }
+    std::cout << std::flush;
+    return 0;
+  }
+
+  int edges(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    GeoObject obj(argv[0]);
+    std::vector<uint32_t> e;
+    double ms = time_ms([&] { e = GeoObject::unique_edges(obj.indices(), obj.face_count(), obj.vertex_count()); });
+    std::cout << "  line segments per face loop: " << 3*obj.face_count() << "\n"
+              << "  unique edges: " << e.size() / 2 << " ("
+              << 100.0 * e.size() / 2 / (3*obj.face_count()) << "%), extracted in " << ms << " ms" << std::endl;
+    return 0;
+  }
+
+  const float kTransform[16] = {
+    0.8f, 0.0f, -0.6f, 0.0f,  0.36f, 0.8f, 0.48f, 0.0f,  0.48f, -0.6f, 0.64f, 0.0f,  0.0f, 0.0f, -5.0f, 1.0f,
+  };
+
+  // Walks the index buffer like the GPU front end: a vertex is only
+  // transformed when it has fallen out of a FIFO of `cache_size`. `fetch`
+  // loads vertex v into x y z.
+  template <class Fetch>
+  float cached_transform(const uint32_t *indices, std::size_t index_count, std::size_t vertex_count,
+                         int cache_size, Fetch fetch) {
+    const float *m = kTransform;
+    std::vector<long> entered(vertex_count, -1);
+    std::vector<float> out(4*vertex_count);
+    long misses = 0;
+    for (std::size_t i = 0; i < index_count; i++) {
+      uint32_t v = indices[i];
+      if (entered[v] >= 0 && misses - entered[v] < cache_size) {
+        continue;
+      }
+      entered[v] = misses++;
+      float x, y, z;
+      fetch(v, x, y, z);
+      for (int r = 0; r < 4; r++) {
+        out[4*v + r] = m[r]*x + m[4 + r]*y + m[8 + r]*z + m[12 + r];
+      }
+    }
+    float sum = 0;
+    for (std::size_t v = 0; v < vertex_count; v += 997) {
+      sum += out[4*v];
+    }
+    return sum;
+  }
+
+  int optimize(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    int cache_size = argc > 1 ? std::atoi(argv[1]) : 16;
+    ObjMesh mesh = load_obj(argv[0]);
+    const float *positions = mesh.positions.data();
+    std::size_t nv = mesh.positions.size() / 3, nf = mesh.triangle_count();
+    std::vector<uint32_t> original(mesh.position_indices.begin(), mesh.position_indices.end());
+
+    std::vector<uint32_t> order, remap;
+    double tipsify_ms = time_ms([&] { order = tipsify(original.data(), nf, nv, cache_size); }, 1);
+    remap = order_by_first_use(order.data(), order.size(), nv);
+    std::vector<float> x(nv), y(nv), z(nv), aos(3*nv);
+    for (std::size_t v = 0; v < nv; v++) {
+      x[remap[v]] = positions[3*v];
+      y[remap[v]] = positions[3*v + 1];
+      z[remap[v]] = positions[3*v + 2];
+      std::copy(positions + 3*v, positions + 3*v + 3, aos.begin() + 3*remap[v]);
+    }
+
+    std::cout << argv[0] << ": " << nv << " verts, " << nf << " triangles, tipsify in " << tipsify_ms << " ms\n";
+    for (int size: {cache_size / 2, cache_size, 2*cache_size}) {
+      std::cout << "  ACMR, " << size << " entry FIFO: " << acmr(original.data(), nf, nv, size) << " -> "
+                << acmr(order.data(), nf, nv, size) << "\n";
+    }
+
+    volatile float sink;
+    auto aos_fetch = [](const float *p) {
+      return [p](uint32_t v, float& x, float& y, float& z) { x = p[3*v]; y = p[3*v + 1]; z = p[3*v + 2]; };
+    };
+    double before = time_ms([&] { sink = cached_transform(original.data(), 3*nf, nv, cache_size, aos_fetch(positions)); });
+    double reordered = time_ms([&] { sink = cached_transform(order.data(), 3*nf, nv, cache_size, aos_fetch(aos.data())); });
+    double soa = time_ms([&] {
+      sink = cached_transform(order.data(), 3*nf, nv, cache_size, [&](uint32_t v, float& px, float& py, float& pz) {
+        px = x[v]; py = y[v]; pz = z[v];
+      });
+    });
+    (void)sink;
+    std::cout << "  cached transform, original order: " << before << " ms\n"
+              << "  cached transform, optimized AoS:  " << reordered << " ms (" << before / reordered << "x)\n"
+              << "  cached transform, optimized SoA:  " << soa << " ms (" << before / soa << "x)" << std::endl;
+    return 0;
+  }
+
+  int compact(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    GeoObject obj(argv[0]);
+    obj.optimize();
+    std::size_t nv = obj.vertex_count(), nf = obj.face_count();
+    const float *positions = obj.positions();
+    CompactMesh mesh;
+    double compress_ms = time_ms([&] { mesh = compress_mesh(positions, nullptr, nv, obj.indices(), nf); }, 1);
+
+    double err = 0, extent = 0;
+    float p[3];
+    for (std::size_t v = 0; v < nv; v++) {
+      decode_position(mesh, v, p);
+      for (int k = 0; k < 3; k++) {
+        err = std::max<double>(err, fabs(p[k] - positions[3*v + k]));
+        extent = std::max(extent, 2.0 * mesh.step[k] * 32767);
+      }
+    }
+    std::vector<uint32_t> indices = decode_indices(mesh);
+    bool same = std::equal(indices.begin(), indices.end(), obj.indices());
+
+    double raw = 12.0*nv + 12.0*nf + 12.0*nv;
+    std::cout << "  bytes per vertex   float + uint32 + float normals: " << raw / nv
+              << "  compact: " << static_cast<double>(mesh.bytes()) / nv << " ("
+              << 2.0*mesh.positions.size() / nv << " position, " << 1.0*mesh.normals.size() / nv << " normal, "
+              << 1.0*mesh.indices.size() / nv << " index)\n"
+              << "  compressed in " << compress_ms << " ms, max position error " << err / extent * 100
+              << "% of the bounding box, indices " << (same ? "round-trip" : "DIFFER") << "\n";
+
+    // Everything a GeoObject holds, edges and face planes included, as
+    // loaded and after compress()
+    GeoObject held(argv[0]);
+    held.optimize();
+    std::size_t before = held.bytes();
+    held.compress();
+    std::cout << "  GeoObject memory: " << before / 1024 << " KB -> " << held.bytes() / 1024 << " KB ("
+              << static_cast<double>(before) / nv << " -> " << static_cast<double>(held.bytes()) / nv
+              << " bytes per vertex)\n";
+
+    std::vector<float> out(4*nv);
+    const float *m = kTransform;
+    double plain = time_ms([&] {
+      float *o = out.data();
+      for (std::size_t v = 0; v < nv; v++, o += 4) {
+        const float *q = positions + 3*v;
+        for (int r = 0; r < 4; r++) {
+          o[r] = m[r]*q[0] + m[4 + r]*q[1] + m[8 + r]*q[2] + m[12 + r];
+        }
+      }
+    }, 5);
+    double decoded = time_ms([&] { transform_compact(mesh, kTransform, out.data()); }, 5);
+    double unpack = time_ms([&] { indices = decode_indices(mesh); }, 5);
+    std::cout << "  transform float positions: " << nv / plain / 1e3 << " M verts/s\n"
+              << "  transform compact positions: " << nv / decoded / 1e3 << " M verts/s\n"
+              << "  index decode: " << 3*nf / unpack / 1e3 << " M indices/s" << std::endl;
+    return 0;
+  }
+
+  int lod(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    GeoObject obj(argv[0]);
+    obj.optimize();
+    LodChain chain;
+    double ms = time_ms([&] { chain = LodChain(obj); }, 1);
+    std::cout << "  chain built in " << ms << " ms\n";
+    for (std::size_t i = 0; i < chain.size(); i++) {
+      std::cout << "  level " << i << ": " << chain[i].face_count() << " faces, " << chain[i].edge_count()
+                << " edges, error " << chain.error(i) / obj.radius() * 100 << "% of the radius\n";
+    }
+    // What the teapot scene would draw as the model shrinks on a 480 pixel window
+    for (double pixels = 480; pixels >= 15; pixels /= 2) {
+      std::size_t level = chain.pick(pixels / 2 / obj.radius());
+      std::cout << "  " << pixels << " px across: level " << level << ", "
+                << chain[level].edge_count() << " lines\n";
+    }
+    std::cout << std::flush;
+    return 0;
+  }
+
+  int bvh(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    int rays = argc > 1 ? std::atoi(argv[1]) : 100000;
+    GeoObject obj(argv[0]);
+    Bvh tree;
+    double build = time_ms([&] { tree = Bvh(obj); }, 1);
+    std::cout << "  built in " << build << " ms: " << tree.node_count() << " nodes, depth " << tree.depth() << "\n";
+
+    // Rays from a sphere around the mesh at points inside its bounds
+    const float *lo = obj.bounds_min(), *hi = obj.bounds_max();
+    float center[3], r = 2*obj.radius();
+    for (int k = 0; k < 3; k++) {
+      center[k] = (lo[k] + hi[k]) / 2;
+    }
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    std::vector<float> origins(3*rays), dirs(3*rays);
+    for (int i = 0; i < rays; i++) {
+      float d[3] = {unit(rng), unit(rng), unit(rng)};
+      float len = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]) + 1e-6f;
+      for (int k = 0; k < 3; k++) {
+        origins[3*i + k] = center[k] + r*d[k]/len;
+        float target = lo[k] + (hi[k] - lo[k]) * (unit(rng) + 1) / 2;
+        dirs[3*i + k] = target - origins[3*i + k];
+      }
+    }
+    int hits = 0;
+    double query = time_ms([&] {
+      hits = 0;
+      for (int i = 0; i < rays; i++) {
+        Bvh::Hit hit;
+        hits += tree.intersect(&origins[3*i], &dirs[3*i], hit);
+      }
+    });
+    std::cout << "  " << rays << " rays in " << query << " ms: " << rays / query / 1e3 << " M rays/s, "
+              << hits << " hits\n";
+
+    // Brute force on a few rays, as a check and for scale
+    int checks = std::min(rays, 20), mismatches = 0;
+    double brute = time_ms([&] {
+      for (int i = 0; i < checks; i++) {
+        Bvh::Hit hit;
+        bool found = tree.intersect(&origins[3*i], &dirs[3*i], hit);
+        float best = INFINITY;
+        const float *o = &origins[3*i], *d = &dirs[3*i];
+        for (std::size_t f = 0; f < obj.face_count(); f++) {
+          const float *a = obj.positions() + 3*obj.indices()[3*f];
+          const float *b = obj.positions() + 3*obj.indices()[3*f + 1];
+          const float *c = obj.positions() + 3*obj.indices()[3*f + 2];
+          float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]}, e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+          float p[3] = {d[1]*e2[2] - d[2]*e2[1], d[2]*e2[0] - d[0]*e2[2], d[0]*e2[1] - d[1]*e2[0]};
+          float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+          if (fabsf(det) < 1e-12f) continue;
+          float s[3] = {o[0] - a[0], o[1] - a[1], o[2] - a[2]};
+          float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) / det;
+          float q[3] = {s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0]};
+          float v = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) / det;
+          float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) / det;
+          if (u >= 0 && v >= 0 && u + v <= 1 && t > 0) best = std::min(best, t);
+        }
+        if (found != (best < INFINITY) || (found && fabsf(hit.t - best) > 1e-4f * best)) {
+          mismatches++;
+        }
+      }
+    }, 1);
+    std::cout << "  brute force on " << checks << " rays: " << brute / checks / (query / rays)
+              << "x slower per ray, " << mismatches << " mismatches\n";
+
+    // Frustum: everything on the positive x side of the center, inside the bounds
+    float planes[6][4] = {
+      {1, 0, 0, -center[0]}, {-1, 0, 0, hi[0]}, {0, 1, 0, -lo[1]}, {0, -1, 0, hi[1]}, {0, 0, 1, -lo[2]}, {0, 0, -1, hi[2]},
+    };
+    std::vector<uint32_t> faces;
+    double frustum = time_ms([&] { faces.clear(); tree.frustum(planes, 6, faces); }, 5);
+    std::cout << "  half-space frustum: " << faces.size() << " of " << obj.face_count() << " faces in "
+              << frustum << " ms" << std::endl;
+    return 0;
+  }
+
+  // Column-major, a*b
+  void mat_mul(const float a[16], const float b[16], float out[16]) {
+    float r[16];
+    for (int c = 0; c < 4; c++) {
+      for (int i = 0; i < 4; i++) {
+        r[4*c + i] = a[i]*b[4*c] + a[4 + i]*b[4*c + 1] + a[8 + i]*b[4*c + 2] + a[12 + i]*b[4*c + 3];
+      }
+    }
+    std::copy(r, r + 16, out);
+  }
+
+  // What display() sets up for the teapot: gluPerspective(60, aspect, 1,
+  // 500000), eye at z = 20, the mouse rotation, then translate and scale
+  void teapot_matrix(float aspect, float yaw, float pitch, float scale, float out[16]) {
+    float f = 1 / tanf(M_PI / 6), n = 1, far = 500000;
+    float projection[16] = {f / aspect, 0, 0, 0,  0, f, 0, 0,  0, 0, (far + n) / (n - far), -1,  0, 0, 2*far*n / (n - far), 0};
+    float view[16] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, -20, 1};
+    float cy = cosf(yaw * M_PI / 180), sy = sinf(yaw * M_PI / 180);
+    float cp = cosf(pitch * M_PI / 180), sp = sinf(pitch * M_PI / 180);
+    float rot_y[16] = {cy, 0, -sy, 0,  0, 1, 0, 0,  sy, 0, cy, 0,  0, 0, 0, 1};
+    float rot_x[16] = {1, 0, 0, 0,  0, cp, sp, 0,  0, -sp, cp, 0,  0, 0, 0, 1};
+    float model[16] = {scale, 0, 0, 0,  0, scale, 0, 0,  0, 0, scale, 0,  0, -5, 0, 1};
+    mat_mul(projection, view, out);
+    mat_mul(out, rot_y, out);
+    mat_mul(out, rot_x, out);
+    mat_mul(out, model, out);
+  }
+
+  int render(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    int width = argc > 2 ? std::atoi(argv[1]) : 640;
+    int height = argc > 2 ? std::atoi(argv[2]) : 480;
+    const char *out = argc > 3 ? argv[3] : nullptr;
+    GeoObject obj(argv[0]);
+    obj.optimize();
+    std::size_t nv = obj.vertex_count();
+
+    const int frames = 30;
+    ClipVertices clip;
+    SoftRaster raster(width, height);
+    float m[16];
+    teapot_matrix(static_cast<float>(width) / height, 30, 20, 3, m);
+
+    double simd = time_ms([&] { transform_vertices(obj.soa(), m, clip); }, frames);
+    double scalar = time_ms([&] { transform_vertices(obj.soa(), m, clip, false); }, frames);
+    double raster_ms = time_ms([&] {
+      raster.clear();
+      raster.draw_edges(clip, obj.edges(), obj.edge_count());
+    }, frames);
+    double frame = time_ms([&] {
+      static int i = 0;
+      teapot_matrix(static_cast<float>(width) / height, 30 + i++, 20, 3, m);
+      transform_vertices(obj.soa(), m, clip);
+      raster.clear();
+      raster.draw_edges(clip, obj.edges(), obj.edge_count());
+    }, frames);
+
+    std::cout << "  " << nv << " unique vertices (" << 3*obj.face_count() << " face corners, "
+              << 2*obj.edge_count() << " edge ends)\n"
+              << "  transform " << transform_isa() << ": " << simd << " ms, " << nv / simd / 1e3 << " M verts/s\n"
+              << "  transform scalar: " << scalar << " ms, " << nv / scalar / 1e3 << " M verts/s\n"
+              << "  rasterize " << obj.edge_count() << " lines at " << width << "x" << height << ": " << raster_ms
+              << " ms, " << raster.lit() << " pixels\n"
+              << "  whole frame: " << frame << " ms (" << 1000 / frame << " fps)" << std::endl;
+    if (out) {
+      raster.write_pgm(out);
+      std::cout << "  wrote " << out << std::endl;
+    }
+    return 0;
+  }
+
+  // Smooth gradients with a checker on top, so filtering shows
+  std::shared_ptr<Bitmap> test_bitmap(int width, int height) {
+    auto bmp = std::make_shared<Bitmap>(width, height);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        unsigned char *p = &bmp->data[3*(y*width + x)];
+        bool check = ((x / 16) + (y / 16)) % 2;
+        p[0] = 255 * x / width;
+        p[1] = 255 * y / height;
+        p[2] = check ? 200 : 40;
+      }
+    }
+    return bmp;
+  }
+
+  // The flower's four triangles over `bmp`, center moved by (dx, dy) of the size
+  void flower_triangles(const MipChain& levels, double dx, double dy, Triangle out[4]) {
+    double w = levels[0]->width, h = levels[0]->height;
+    Vertex nw{0, 0}, ne{w, 0}, se{w, h}, sw{0, h}, center{w/2, h/2};
+    out[0] = Triangle{levels, nw, ne, center};
+    out[1] = Triangle{levels, ne, se, center};
+    out[2] = Triangle{levels, se, sw, center};
+    out[3] = Triangle{levels, sw, nw, center};
+    for (int i = 0; i < 4; i++) {
+      out[i].v3 = Vertex{w/2 + dx*w, h/2 + dy*h};
+    }
+  }
+
+  int warp(int argc, char *argv[]) {
+    int max_size = argc > 0 ? std::atoi(argv[0]) : 4096;
+    unsigned threads = argc > 1 ? std::atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    for (int size = 256; size <= max_size; size *= 2) {
+      int w = size, h = size * 2 / 3;
+      auto bmp = test_bitmap(w, h);
+      Triangle tris[4];
+      Bitmap dst(w, h);
+      std::cout << "  " << w << "x" << h << ":";
+
+      // What make_flower_texture used to build: a map node per texel
+      if (size <= 1024) {
+        std::map<BaryVertex, Color> maps[4];
+        flower_triangles({bmp}, 0, 0, tris);
+        double build = time_ms([&] {
+          for (auto& m: maps) {
+            m.clear();
+          }
+          for (int i = 0; i < w; i++) {
+            for (int j = 0; j < h; j++) {
+              Vertex v(i, j);
+              const unsigned char *p = &bmp->data[3*(j*w + i)];
+              for (int k = 0; k < 4; k++) {
+                if (tris[k].contains_vert(v)) {
+                  maps[k].insert(std::make_pair(tris[k].get_coords(v), Color(p[2], p[1], p[0])));
+                  break;
+                }
+              }
+            }
+          }
+        }, 1);
+        // Key, value, three links and a color per red-black node, plus malloc's header
+        double node = sizeof(std::pair<const BaryVertex, Color>) + 4*sizeof(void *) + 16;
+        std::cout << "  map build " << build << " ms, ~" << node << " B/texel;";
+      }
+
+      // Unmoved and nearest should give back the source exactly
+      flower_triangles({bmp}, 0, 0, tris);
+      for (auto& t: tris) {
+        t.warp(dst, FILTER_NEAREST);
+      }
+      bool exact = std::equal(dst.data.get(), dst.data.get() + 3*w*h, bmp->data.get());
+
+      flower_triangles({bmp}, -0.2, 0.1, tris);
+      // Just finding each pixel's triangle the old way, contains_vert per pixel
+      long found = 0;
+      double classify = time_ms([&] {
+        for (int j = 0; j < h; j++) {
+          for (int i = 0; i < w; i++) {
+            for (auto& t: tris) {
+              if (t.contains_vert(Vertex(i, j))) {
+                found++;
+                break;
+              }
+            }
+          }
+        }
+      }, 1);
+      double nearest = time_ms([&] { warp_triangles(tris, 4, dst, FILTER_NEAREST, 1, 1); });
+      double bilinear = time_ms([&] { warp_triangles(tris, 4, dst, FILTER_BILINEAR, 1, 1); });
+      double parallel = time_ms([&] { warp_triangles(tris, 4, dst, FILTER_BILINEAR, 1, threads); });
+      std::cout << "  contains_vert " << classify << " ms;  3 B/texel, warp nearest " << nearest << " ms, bilinear "
+                << bilinear << " ms (" << w*h / bilinear / 1e3 << " Mpix/s), " << threads << " threads " << parallel
+                << " ms" << (exact && found > 0 ? "" : ", IDENTITY WARP DIFFERS") << std::endl;
+    }
+    return 0;
+  }
+
+  // 24 or 32 bit, rows padded to 4 bytes, optionally top-down with a
+  // negative height and a gap before the pixels
+  void write_bmp(const std::string& filename, const Bitmap& bmp, int bpp, bool top_down, int gap = 0) {
+    std::size_t stride = (static_cast<std::size_t>(bmp.width)*bpp + 31) / 32 * 4;
+    uint32_t offset = 54 + gap;
+    std::vector<unsigned char> out(offset + stride*bmp.height, 0);
+    auto put = [&](std::size_t at, uint32_t v, int n) {
+      for (int i = 0; i < n; i++) {
+        out[at + i] = v >> (8*i);
+      }
+    };
+    out[0] = 'B';
+    out[1] = 'M';
+    put(2, out.size(), 4);
+    put(10, offset, 4);
+    put(14, 40, 4);
+    put(18, bmp.width, 4);
+    put(22, top_down ? -bmp.height : bmp.height, 4);
+    put(26, 1, 2);
+    put(28, bpp, 2);
+    for (int y = 0; y < bmp.height; y++) {
+      unsigned char *row = &out[offset + stride*(top_down ? bmp.height - 1 - y : y)];
+      for (int x = 0; x < bmp.width; x++) {
+        std::memcpy(row + x*bpp/8, &bmp.data[3*(y*bmp.width + x)], 3);
+        if (bpp == 32) {
+          row[4*x + 3] = 255;
+        }
+      }
+    }
+    std::ofstream(filename, std::ios::binary).write(reinterpret_cast<const char *>(out.data()), out.size());
+  }
+
+  int bmp(int argc, char *argv[]) {
+    int max_size = argc > 0 ? std::atoi(argv[0]) : 4096;
+    const std::string file = "/tmp/bench.bmp";
+
+    // Odd widths so every row is padded
+    auto odd = test_bitmap(383, 255);
+    struct { int bpp; bool top_down; int gap; } variants[] = {{24, false, 0}, {24, true, 0}, {32, false, 0}, {32, true, 10}};
+    for (auto& v: variants) {
+      write_bmp(file, *odd, v.bpp, v.top_down, v.gap);
+      Bitmap back = load_bmp(file.c_str());
+      bool same = back.width == odd->width && back.height == odd->height &&
+                  std::equal(back.data.get(), back.data.get() + 3*back.width*back.height, odd->data.get());
+      std::cout << "  " << v.bpp << " bit" << (v.top_down ? " top-down" : "") << (v.gap ? " with gap" : "")
+                << ": " << (same ? "ok" : "DIFFERS") << std::endl;
+    }
+
+    for (int size = 256; size <= max_size; size *= 2) {
+      int w = size, h = size * 2 / 3;
+      auto base = test_bitmap(w, h);
+      write_bmp(file, *base, 24, false);
+      double mb = 3.0*w*h / 1e6;
+      double load = time_ms([&] { load_bmp(file.c_str()); });
+      MipChain scalar, simd;
+      double scalar_ms = time_ms([&] { scalar = build_mips(base, false); });
+      double simd_ms = time_ms([&] { simd = build_mips(base, true); });
+      bool same = scalar.size() == simd.size();
+      for (std::size_t i = 1; same && i < simd.size(); i++) {
+        const Bitmap &a = *scalar[i], &b = *simd[i];
+        same = std::equal(a.data.get(), a.data.get() + 3*a.width*a.height, b.data.get());
+      }
+      std::cout << "  " << w << "x" << h << ": load " << load << " ms (" << mb / load * 1e3 << " MB/s), "
+                << simd.size() << " mips scalar " << scalar_ms << " ms, simd " << simd_ms << " ms ("
+                << mb / simd_ms * 1e3 << " MB/s)" << (same ? "" : ", SIMD MIPS DIFFER") << std::endl;
+    }
+    std::remove(file.c_str());
+    return 0;
+  }
+
+  // The flower being dragged in a circle that reaches past the bitmap's
+  // edges, as the window allows: every frame moves the center, fits the
+  // canvas to the triangles as main does, clears it and re-warps all four.
+  // Mean ms per frame; canvas is left at the last frame's bounds.
+  double morph_frames(const MipChain& levels, Bitmap& canvas, double scale, bool simd, int frames) {
+    Triangle tris[4];
+    flower_triangles(levels, 0, 0, tris);
+    double w = levels[0]->width, h = levels[0]->height;
+    double total = time_ms([&] {
+      for (int f = 0; f < frames; f++) {
+        double t = 2*M_PI*f / frames;
+        for (auto& tri: tris) {
+          tri.v3 = Vertex{w*(0.5 + 0.8*cos(t)), h*(0.5 + 0.8*sin(t))};
+        }
+        WarpBounds b = warp_bounds(tris, 4, scale);
+        if (canvas.width != b.width || canvas.height != b.height) {
+          canvas = Bitmap(b.width, b.height);
+        }
+        std::fill(canvas.data.get(), canvas.data.get() + 3*canvas.width*canvas.height, 0);
+        for (auto& tri: tris) {
+          tri.warp(canvas, FILTER_BILINEAR, scale, simd, Vertex(b.x, b.y));
+        }
+      }
+    }, 1);
+    return total / frames;
+  }
+
+  int morph(int argc, char *argv[]) {
+    int max_size = argc > 0 ? std::atoi(argv[0]) : 4096;
+    // The window main.cpp opens, which sets the canvas scale
+    const int win_w = 640, win_h = 480;
+    std::cout << "simd path: " << warp_isa() << std::endl;
+    for (int size = 256; size <= max_size; size *= 2) {
+      int w = size, h = size * 2 / 3;
+      auto bmp = test_bitmap(w, h);
+      double scale = std::min({1.0, static_cast<double>(win_w) / w, static_cast<double>(win_h) / h});
+      Bitmap screen(1, 1), full(1, 1);
+      std::cout << "  " << w << "x" << h << ":";
+
+      auto report = [&](const char *label, const MipChain& levels, Bitmap& canvas, double s, int frames) {
+        double scalar = morph_frames(levels, canvas, s, false, frames);
+        std::vector<unsigned char> reference(canvas.data.get(), canvas.data.get() + 3*canvas.width*canvas.height);
+        double simd = morph_frames(levels, canvas, s, true, frames);
+        int diff = 0;
+        for (std::size_t i = 0; i < reference.size(); i++) {
+          diff = std::max(diff, std::abs(reference[i] - canvas.data[i]));
+        }
+        std::cout << "  " << label << " " << canvas.width << "x" << canvas.height << " at the end, scalar " << scalar
+                  << " ms, simd " << simd << " ms (" << 1000 / simd << " fps, max diff " << diff << ");";
+      };
+      report("screen", {bmp}, screen, scale, 60);
+      if (scale < 1) {
+        report("screen from mips", build_mips(bmp), screen, scale, 60);
+      }
+      report("full", {bmp}, full, 1, w*h > (1 << 22) ? 4 : 16);
+      std::cout << std::endl;
+    }
+    return 0;
+  }
+
+  // What HW4's init used to do before the first frame, then the same work
+  // through AssetManager
+  int assets(int argc, char *argv[]) {
+    if (argc < 1) {
+      return -1;
+    }
+    std::string obj = argv[0], bmp_file = argc > 1 ? argv[1] : "flower.bmp";
+    auto load_flower = [bmp_file] {
+      return std::make_shared<const MipChain>(build_mips(std::make_shared<Bitmap>(load_bmp(bmp_file.c_str()))));
+    };
+    auto load_teapot = [obj] {
+      GeoObject mesh(obj);
+      mesh.optimize();
+      auto lods = std::make_shared<LodChain>(mesh);
+      Bvh bvh(mesh);
+      return lods;
+    };
+
+    double sync = time_ms([&] { load_flower(); load_teapot(); }, 1);
+
+    auto start = AssetManager::Clock::now();
+    AssetManager manager(start);
+    auto flower = manager.load<const MipChain>(bmp_file, load_flower);
+    double first_frame = manager.elapsed_ms();
+    flower.wait();
+    double flower_ready = manager.elapsed_ms();
+    // The teapot isn't asked for until its scene is switched to
+    auto teapot = manager.load<LodChain>(obj, load_teapot);
+    teapot.wait();
+    double teapot_ready = manager.elapsed_ms();
+    std::cout << "everything before the first frame: " << sync << " ms\n"
+              << "async: first frame after " << first_frame << " ms, " << bmp_file << " ready after "
+              << flower_ready << " ms, " << obj << " " << teapot_ready - flower_ready << " ms after its scene is shown"
+              << std::endl;
+    return 0;
+  }
+
+  struct Bench {
+    const char *name;
+    int (*run)(int, char *[]);
+    const char *usage;
+  };
+
+  const Bench benches[] = {
+    {"make-obj", make_obj, "<file.obj> <triangles> [plain]  write a test torus"},
+    {"obj", obj, "<file.obj> [threads]  OBJ parse throughput"},
+    {"assets", assets, "<file.obj> [file.bmp]  startup with everything loaded up front vs in the background"},
+    {"bvh", bvh, "<file.obj> [rays]  BVH build, ray and frustum query time"},
+    {"cache", cache, "<file.obj>  startup with and without the mesh cache"},
+    {"cull", cull, "<file.obj>  lines left by back-face and silhouette culling"},
+    {"edges", edges, "<file.obj>  unique edge extraction"},
+    {"compact", compact, "<file.obj>  quantized mesh size, error and transform throughput"},
+    {"lod", lod, "<file.obj>  simplification chain and the level picked per screen size"},
+    {"optimize", optimize, "<file.obj> [cache size]  ACMR and transform time before/after reordering"},
+    {"render", render, "<file.obj> [width height] [out.pgm]  software transform and wireframe of the teapot scene"},
+    {"warp", warp, "[max size] [threads]  flower warp time per bitmap size"},
+    {"bmp", bmp, "[max size]  BMP variants, load and mip build throughput"},
+    {"morph", morph, "[max size]  frame time of the dragged flower per bitmap size, scalar and simd"},
+  };
+}
+
+int run_bench(int argc, char *argv[]) {
+  if (argc > 0) {
+    for (auto& b: benches) {
+      if (std::strcmp(argv[0], b.name) == 0) {
+        try {
+          int status = b.run(argc - 1, argv + 1);
+          if (status >= 0) {
+            return status;
+          }
+          std::cerr << "usage: graphics bench " << b.name << " " << b.usage << std::endl;
+        } catch (const std::runtime_error& e) {
+          std::cerr << e.what() << std::endl;
+        }
+        return 1;
+      }
+    }
+  }
+  std::cerr << "usage: graphics bench <name> [args...]\n";
+  for (auto& b: benches) {
+    std::cerr << "  " << b.name << " " << b.usage << "\n";
+  }
+  return 1;
+}
@@ -0,0 +1,8 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+// `./graphics bench <name> [args...]` runs one benchmark headless, without
+// opening a window, prints its results and returns the exit code
+int run_bench(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,264 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+namespace {
+  const int kBins = 16;
+  const uint32_t kLeafSize = 4;
+  const int kMaxDepth = 60; // traversal stacks are 64 deep
+
+  struct Box {
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+    void grow(const float *lo_, const float *hi_) {
+      for (int k = 0; k < 3; k++) {
+        lo[k] = std::min(lo[k], lo_[k]);
+        hi[k] = std::max(hi[k], hi_[k]);
+      }
+    }
+    float area() const {
+      float d[3];
+      for (int k = 0; k < 3; k++) {
+        d[k] = std::max(0.0f, hi[k] - lo[k]);
+      }
+      return d[0]*d[1] + d[1]*d[2] + d[2]*d[0];
+    }
+  };
+
+  // Slab test, returns the entry distance or INFINITY
+  inline float ray_box(const float lo[3], const float hi[3], const float origin[3], const float inv[3], float t_max) {
+    float t0 = 0, t1 = t_max;
+    for (int k = 0; k < 3; k++) {
+      float a = (lo[k] - origin[k]) * inv[k];
+      float b = (hi[k] - origin[k]) * inv[k];
+      t0 = std::max(t0, std::min(a, b));
+      t1 = std::min(t1, std::max(a, b));
+    }
+    return t0 <= t1 ? t0 : INFINITY;
+  }
+}
+
+Bvh::Bvh(const GeoObject& mesh) {
+  const float *positions = mesh.positions();
+  const uint32_t *indices = mesh.indices();
+  std::size_t n = positions ? mesh.face_count() : 0;
+  if (n == 0) {
+    return;
+  }
+  std::vector<Ref> refs(n);
+  for (std::size_t f = 0; f < n; f++) {
+    Ref& r = refs[f];
+    r.face = f;
+    for (int k = 0; k < 3; k++) {
+      r.lo[k] = INFINITY;
+      r.hi[k] = -INFINITY;
+    }
+    for (int c = 0; c < 3; c++) {
+      const float *p = positions + 3*indices[3*f + c];
+      for (int k = 0; k < 3; k++) {
+        r.lo[k] = std::min(r.lo[k], p[k]);
+        r.hi[k] = std::max(r.hi[k], p[k]);
+      }
+    }
+    for (int k = 0; k < 3; k++) {
+      r.centroid[k] = (r.lo[k] + r.hi[k]) / 2;
+    }
+  }
+  nodes_.reserve(2*n / kLeafSize + 1);
+  nodes_.push_back(Node{{0, 0, 0}, {0, 0, 0}, 0, static_cast<uint32_t>(n), 0});
+  build(0, refs, 1);
+
+  faces_.resize(n);
+  corners_.resize(9*n);
+  for (std::size_t i = 0; i < n; i++) {
+    uint32_t f = faces_[i] = refs[i].face;
+    for (int c = 0; c < 3; c++) {
+      std::copy(positions + 3*indices[3*f + c], positions + 3*indices[3*f + c] + 3, &corners_[9*i + 3*c]);
+    }
+  }
+}
+
+void Bvh::build(uint32_t index, std::vector<Ref>& refs, int depth) {
+  depth_ = std::max(depth_, depth);
+  uint32_t first = nodes_[index].first, count = nodes_[index].count;
+  Ref *begin = refs.data() + first, *end = begin + count;
+  Box bounds, centers;
+  for (Ref *r = begin; r != end; r++) {
+    bounds.grow(r->lo, r->hi);
+    centers.grow(r->centroid, r->centroid);
+  }
+  std::copy(bounds.lo, bounds.lo + 3, nodes_[index].lo);
+  std::copy(bounds.hi, bounds.hi + 3, nodes_[index].hi);
+  if (count <= kLeafSize || depth >= kMaxDepth) {
+    return;
+  }
+
+  // Bin centroids along each axis and price every split between bins
+  int best_axis = -1, best_split = 0;
+  float best_cost = count * bounds.area();
+  for (int axis = 0; axis < 3; axis++) {
+    float lo = centers.lo[axis], extent = centers.hi[axis] - lo;
+    if (extent <= 0) {
+      continue;
+    }
+    float scale = kBins / extent;
+    Box bins[kBins];
+    uint32_t counts[kBins] = {};
+    for (Ref *r = begin; r != end; r++) {
+      int b = std::min(kBins - 1, static_cast<int>((r->centroid[axis] - lo) * scale));
+      bins[b].grow(r->lo, r->hi);
+      counts[b]++;
+    }
+    float right_area[kBins];
+    uint32_t right_count[kBins];
+    Box right;
+    uint32_t n = 0;
+    for (int b = kBins - 1; b > 0; b--) {
+      right.grow(bins[b].lo, bins[b].hi);
+      n += counts[b];
+      right_area[b] = right.area();
+      right_count[b] = n;
+    }
+    Box left;
+    n = 0;
+    for (int b = 0; b < kBins - 1; b++) {
+      left.grow(bins[b].lo, bins[b].hi);
+      n += counts[b];
+      float cost = n * left.area() + right_count[b + 1] * right_area[b + 1];
+      if (n > 0 && right_count[b + 1] > 0 && cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b;
+      }
+    }
+  }
+
+  Ref *mid;
+  if (best_axis < 0) {
+    if (count <= 4*kLeafSize) {
+      return;
+    }
+    // Nothing beats a leaf but it's too big, so cut it in half by centroid
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+      if (centers.hi[k] - centers.lo[k] > centers.hi[axis] - centers.lo[axis]) {
+        axis = k;
+      }
+    }
+    mid = begin + count / 2;
+    std::nth_element(begin, mid, end, [&](const Ref& a, const Ref& b) { return a.centroid[axis] < b.centroid[axis]; });
+  } else {
+    float lo = centers.lo[best_axis], scale = kBins / (centers.hi[best_axis] - lo);
+    mid = std::partition(begin, end, [&](const Ref& r) {
+      return std::min(kBins - 1, static_cast<int>((r.centroid[best_axis] - lo) * scale)) <= best_split;
+    });
+  }
+
+  uint32_t split = first + (mid - begin);
+  uint32_t left = nodes_.size();
+  nodes_[index].left = left;
+  nodes_.push_back(Node{{0, 0, 0}, {0, 0, 0}, first, split - first, 0});
+  nodes_.push_back(Node{{0, 0, 0}, {0, 0, 0}, split, first + count - split, 0});
+  build(left, refs, depth + 1);
+  build(left + 1, refs, depth + 1);
+}
+
+bool Bvh::intersect(const float origin[3], const float dir[3], Hit& hit) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+  float inv[3];
+  for (int k = 0; k < 3; k++) {
+    inv[k] = 1.0f / dir[k];
+  }
+  hit.t = INFINITY;
+  bool found = false;
+
+  uint32_t stack[64];
+  int top = 0;
+  if (ray_box(nodes_[0].lo, nodes_[0].hi, origin, inv, hit.t) < INFINITY) {
+    stack[top++] = 0;
+  }
+  while (top > 0) {
+    const Node& node = nodes_[stack[--top]];
+    if (node.left == 0) {
+      // Moller-Trumbore
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        const float *a = &corners_[9*i], *b = a + 3, *c = a + 6;
+        float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        float p[3] = {dir[1]*e2[2] - dir[2]*e2[1], dir[2]*e2[0] - dir[0]*e2[2], dir[0]*e2[1] - dir[1]*e2[0]};
+        float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+        if (fabsf(det) < 1e-12f) {
+          continue;
+        }
+        float inv_det = 1 / det;
+        float s[3] = {origin[0] - a[0], origin[1] - a[1], origin[2] - a[2]};
+        float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv_det;
+        if (u < 0 || u > 1) {
+          continue;
+        }
+        float q[3] = {s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0]};
+        float v = (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]) * inv_det;
+        if (v < 0 || u + v > 1) {
+          continue;
+        }
+        float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * inv_det;
+        if (t > 0 && t < hit.t) {
+          hit = Hit{faces_[i], t, u, v, i};
+          found = true;
+        }
+      }
+      continue;
+    }
+    // Push the far child first so the near one is searched first
+    const Node& l = nodes_[node.left];
+    const Node& r = nodes_[node.left + 1];
+    float tl = ray_box(l.lo, l.hi, origin, inv, hit.t);
+    float tr = ray_box(r.lo, r.hi, origin, inv, hit.t);
+    if (tl > tr) {
+      std::swap(tl, tr);
+      if (tr < INFINITY) stack[top++] = node.left;
+      if (tl < INFINITY) stack[top++] = node.left + 1;
+    } else {
+      if (tr < INFINITY) stack[top++] = node.left + 1;
+      if (tl < INFINITY) stack[top++] = node.left;
+    }
+  }
+  return found;
+}
+
+void Bvh::frustum(const float planes[][4], int plane_count, std::vector<uint32_t>& out) const {
+  if (nodes_.empty()) {
+    return;
+  }
+  uint32_t stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node& node = nodes_[stack[--top]];
+    bool inside = true, outside = false;
+    for (int i = 0; i < plane_count && !outside; i++) {
+      const float *p = planes[i];
+      // Box corners furthest along and against the plane normal
+      float far = p[3], near = p[3];
+      for (int k = 0; k < 3; k++) {
+        far += p[k] * (p[k] >= 0 ? node.hi[k] : node.lo[k]);
+        near += p[k] * (p[k] >= 0 ? node.lo[k] : node.hi[k]);
+      }
+      outside = far < 0;
+      inside = inside && near >= 0;
+    }
+    if (outside) {
+      continue;
+    }
+    if (inside || node.left == 0) {
+      out.insert(out.end(), faces_.begin() + node.first, faces_.begin() + node.first + node.count);
+    } else {
+      stack[top++] = node.left + 1;
+      stack[top++] = node.left;
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "GeoObject.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over a GeoObject's triangles, split with the
+// binned surface area heuristic. Triangle corners are copied in leaf order,
+// so the GeoObject needn't outlive it.
+class Bvh {
+  public:
+    struct Hit {
+      uint32_t face;
+      float t; // along the ray, in units of dir
+      float u, v;
+      uint32_t slot;   // where the face's corners were copied to
+    };
+
+    Bvh() = default;
+    explicit Bvh(const GeoObject& mesh);
+
+    // Closest hit with t > 0, false if the ray misses
+    bool intersect(const float origin[3], const float dir[3], Hit& hit) const;
+    // The hit face's three corners, x y z each, from the BVH's own copy
+    const float* corners(const Hit& hit) const { return &corners_[9*hit.slot]; }
+    // Faces whose bounds aren't fully outside any of the planes, each
+    // a x + b y + c z + d >= 0 on the inside. Conservative, so may include
+    // a few faces that only overlap at the corners.
+    void frustum(const float planes[][4], int plane_count, std::vector<uint32_t>& out) const;
+
+    std::size_t node_count() const { return nodes_.size(); }
+    int depth() const { return depth_; }
+  private:
+    struct Node {
+      float lo[3], hi[3];
+      uint32_t first;  // into faces_, covers the whole subtree
+      uint32_t count;
+      uint32_t left;   // right child is left + 1, 0 for a leaf
+    };
+    // A face's bounds and centroid, partitioned in place during the build
+    struct Ref {
+      float lo[3], hi[3], centroid[3];
+      uint32_t face;
+    };
+    void build(uint32_t node, std::vector<Ref>& refs, int depth);
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> faces_;
+    std::vector<float> corners_; // 9 per face in faces_ order, so leaves read straight through
+    int depth_ = 0;
+};
+
+#endif
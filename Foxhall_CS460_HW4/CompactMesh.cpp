@@ -0,0 +1,167 @@
+#include "CompactMesh.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+namespace {
+  const float kQuant = 32767;
+
+  int8_t snorm8(float f) {
+    return static_cast<int8_t>(lroundf(std::max(-1.0f, std::min(1.0f, f)) * 127));
+  }
+
+  float sign(float f) {
+    return f < 0 ? -1.0f : 1.0f;
+  }
+
+  // Project onto the octahedron, fold the lower half over the upper
+  void oct_encode(const float n[3], int8_t out[2]) {
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 == 0) {
+      out[0] = out[1] = 0;
+      return;
+    }
+    float x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0) {
+      float fx = (1 - fabsf(y)) * sign(x);
+      float fy = (1 - fabsf(x)) * sign(y);
+      x = fx;
+      y = fy;
+    }
+    out[0] = snorm8(x);
+    out[1] = snorm8(y);
+  }
+
+  void face_normals_into(const float *positions, std::size_t vertex_count, const uint32_t *indices,
+                         std::size_t face_count, std::vector<float>& normals) {
+    normals.assign(3*vertex_count, 0.0f);
+    for (std::size_t f = 0; f < face_count; f++) {
+      const float *a = positions + 3*indices[3*f];
+      const float *b = positions + 3*indices[3*f + 1];
+      const float *c = positions + 3*indices[3*f + 2];
+      float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+      float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+      // Unnormalized, so bigger faces count for more
+      float n[3] = {e1[1]*e2[2] - e1[2]*e2[1], e1[2]*e2[0] - e1[0]*e2[2], e1[0]*e2[1] - e1[1]*e2[0]};
+      for (int k = 0; k < 3; k++) {
+        for (int c = 0; c < 3; c++) {
+          normals[3*indices[3*f + k] + c] += n[c];
+        }
+      }
+    }
+  }
+}
+
+CompactMesh compress_mesh(const float *positions, const float *normals, std::size_t vertex_count,
+                          const uint32_t *indices, std::size_t face_count) {
+  CompactMesh mesh;
+  mesh.vertex_count = vertex_count;
+  mesh.face_count = face_count;
+
+  float lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+  for (int k = 0; k < 3; k++) {
+    lo[k] = hi[k] = vertex_count ? positions[k] : 0;
+  }
+  for (std::size_t i = 0; i < vertex_count; i++) {
+    for (int k = 0; k < 3; k++) {
+      lo[k] = std::min(lo[k], positions[3*i + k]);
+      hi[k] = std::max(hi[k], positions[3*i + k]);
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    mesh.center[k] = (lo[k] + hi[k]) / 2;
+    float half = (hi[k] - lo[k]) / 2;
+    mesh.step[k] = half > 0 ? half / kQuant : 1;
+  }
+
+  mesh.positions.resize(3*vertex_count);
+  for (std::size_t i = 0; i < 3*vertex_count; i++) {
+    int k = i % 3;
+    float q = (positions[i] - mesh.center[k]) / mesh.step[k];
+    mesh.positions[i] = static_cast<int16_t>(lroundf(std::max(-kQuant, std::min(kQuant, q))));
+  }
+
+  std::vector<float> averaged;
+  if (!normals) {
+    face_normals_into(positions, vertex_count, indices, face_count, averaged);
+    normals = averaged.data();
+  }
+  mesh.normals.resize(2*vertex_count);
+  for (std::size_t i = 0; i < vertex_count; i++) {
+    oct_encode(normals + 3*i, &mesh.normals[2*i]);
+  }
+
+  mesh.indices.reserve(3*face_count);
+  int64_t previous = 0;
+  for (std::size_t i = 0; i < 3*face_count; i++) {
+    int64_t delta = static_cast<int64_t>(indices[i]) - previous;
+    previous = indices[i];
+    uint64_t zigzag = delta < 0 ? (static_cast<uint64_t>(-delta) << 1) - 1 : static_cast<uint64_t>(delta) << 1;
+    do {
+      uint8_t byte = zigzag & 0x7f;
+      zigzag >>= 7;
+      mesh.indices.push_back(zigzag ? byte | 0x80 : byte);
+    } while (zigzag);
+  }
+  mesh.indices.shrink_to_fit();
+  return mesh;
+}
+
+void decode_position(const CompactMesh& mesh, std::size_t v, float out[3]) {
+  for (int k = 0; k < 3; k++) {
+    out[k] = mesh.center[k] + mesh.positions[3*v + k] * mesh.step[k];
+  }
+}
+
+void decode_normal(const CompactMesh& mesh, std::size_t v, float out[3]) {
+  float x = mesh.normals[2*v] / 127.0f, y = mesh.normals[2*v + 1] / 127.0f;
+  float z = 1 - fabsf(x) - fabsf(y);
+  if (z < 0) {
+    float fx = (1 - fabsf(y)) * sign(x);
+    float fy = (1 - fabsf(x)) * sign(y);
+    x = fx;
+    y = fy;
+  }
+  float len = sqrtf(x*x + y*y + z*z);
+  out[0] = x / len;
+  out[1] = y / len;
+  out[2] = z / len;
+}
+
+std::vector<uint32_t> decode_indices(const CompactMesh& mesh) {
+  std::vector<uint32_t> out(3*mesh.face_count);
+  const uint8_t *p = mesh.indices.data();
+  int64_t previous = 0;
+  for (auto& index: out) {
+    uint64_t zigzag = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+      byte = *p++;
+      zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    int64_t delta = (zigzag & 1) ? -static_cast<int64_t>((zigzag + 1) >> 1) : static_cast<int64_t>(zigzag >> 1);
+    previous += delta;
+    index = previous;
+  }
+  return out;
+}
+
+void transform_compact(const CompactMesh& mesh, const float m[16], float *out) {
+  // Fold the dequantization into the matrix: M * (center + q*step)
+  float f[16];
+  for (int r = 0; r < 4; r++) {
+    for (int k = 0; k < 3; k++) {
+      f[4*k + r] = m[4*k + r] * mesh.step[k];
+    }
+    f[12 + r] = m[12 + r] + m[r]*mesh.center[0] + m[4 + r]*mesh.center[1] + m[8 + r]*mesh.center[2];
+  }
+  const int16_t *q = mesh.positions.data();
+  for (std::size_t i = 0; i < mesh.vertex_count; i++, q += 3, out += 4) {
+    float x = q[0], y = q[1], z = q[2];
+    for (int r = 0; r < 4; r++) {
+      out[r] = f[r]*x + f[4 + r]*y + f[8 + r]*z + f[12 + r];
+    }
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef COMPACT_MESH_H_
+#define COMPACT_MESH_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Smaller copy of a triangle mesh for when millions of vertices have to fit:
+//   positions  3 x int16, quantized against the bounding box
+//   normals    2 x int8, octahedral encoding
+//   indices    zigzag varint of the difference to the previous index, a byte
+//              or two each once the mesh is in cache order
+struct CompactMesh {
+  float center[3];
+  float step[3];  // world units per quantization step
+  std::vector<int16_t> positions;
+  std::vector<int8_t> normals;
+  std::vector<uint8_t> indices;
+  std::size_t vertex_count = 0;
+  std::size_t face_count = 0;
+
+  std::size_t bytes() const { return 2*positions.size() + normals.size() + indices.size(); }
+};
+
+// `normals` may be null, then they're averaged from the faces
+CompactMesh compress_mesh(const float *positions, const float *normals, std::size_t vertex_count,
+                          const uint32_t *indices, std::size_t face_count);
+
+void decode_position(const CompactMesh& mesh, std::size_t v, float out[3]);
+void decode_normal(const CompactMesh& mesh, std::size_t v, float out[3]);
+std::vector<uint32_t> decode_indices(const CompactMesh& mesh);
+
+// Decodes each position on the way through `m` (column-major 4x4), writing
+// x y z w per vertex
+void transform_compact(const CompactMesh& mesh, const float m[16], float *out);
+
+#endif
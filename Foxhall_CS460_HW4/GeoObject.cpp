@@ -1,39 +1,356 @@
 #include "GeoObject.hpp"
-#include <fstream>
+#include "Profiler.hpp"
+#include "ObjLoader.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <assert.h>
+#include <math.h>
 #include <OpenGL/gl.h>
 
-GeoObject::GeoObject(std::string filename) {
-  std::ifstream file(filename);
-  std::string leader;
-  double a, b, c;
-  int x, y, z;
+struct GeoObject::Owned {
+  ObjMesh obj;
+  std::vector<uint32_t> edges;
+  std::vector<float> face_planes;
+  std::vector<uint32_t> edge_faces;
+};
+
+namespace {
+  std::vector<float> compute_face_planes(const float* positions, const uint32_t* indices, std::size_t face_count) {
+    std::vector<float> planes(4*face_count);
+    for (std::size_t f = 0; f < face_count; f++) {
+      const float* a = positions + 3*indices[3*f];
+      const float* b = positions + 3*indices[3*f + 1];
+      const float* c = positions + 3*indices[3*f + 2];
+      float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+      float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+      float n[3] = {e1[1]*e2[2] - e1[2]*e2[1], e1[2]*e2[0] - e1[0]*e2[2], e1[0]*e2[1] - e1[1]*e2[0]};
+      float len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+      float* p = &planes[4*f];
+      for (int k = 0; k < 3; k++) {
+        p[k] = len > 0 ? n[k] / len : 0;
+      }
+      p[3] = -(p[0]*a[0] + p[1]*a[1] + p[2]*a[2]);
+    }
+    return planes;
+  }
+
+  // Edges come sorted by lower vertex, so each face edge is found among the
+  // handful that start at its lower end
+  std::vector<uint32_t> compute_edge_faces(const uint32_t* indices, std::size_t face_count, std::size_t vertex_count,
+                                           const uint32_t* edges, std::size_t edge_count) {
+    std::vector<uint32_t> start(vertex_count + 1, 0);
+    for (std::size_t e = 0; e < edge_count; e++) {
+      start[edges[2*e] + 1]++;
+    }
+    for (std::size_t v = 0; v < vertex_count; v++) {
+      start[v+1] += start[v];
+    }
+    std::vector<uint32_t> faces(2*edge_count, UINT32_MAX);
+    for (std::size_t i = 0; i < 3*face_count; i++) {
+      uint32_t a = indices[i], b = indices[i - i%3 + (i+1)%3];
+      uint32_t lo = std::min(a, b), hi = std::max(a, b);
+      for (uint32_t e = start[lo]; e < start[lo+1]; e++) {
+        if (edges[2*e + 1] == hi) {
+          uint32_t* slot = &faces[2*e];
+          if (slot[0] == UINT32_MAX) {
+            slot[0] = i / 3;
+          } else if (slot[1] == UINT32_MAX) {
+            slot[1] = i / 3;
+          }
+          break;
+        }
+      }
+    }
+    return faces;
+  }
+}
+
+GeoObject::GeoObject(std::string filename): filename_{filename} {
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed_ms = [&] {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  MeshCache cache;
+  if (read_mesh_cache(filename, cache)) {
+    storage_ = cache.file;
+    positions_ = cache.positions;
+    indices_ = cache.indices;
+    edges_ = cache.edges;
+    face_planes_ = cache.face_planes;
+    edge_faces_ = cache.edge_faces;
+    vertex_count_ = cache.vertex_count;
+    face_count_ = cache.face_count;
+    edge_count_ = cache.edge_count;
+    optimized_ = cache.optimized;
+    std::copy(cache.bounds_min, cache.bounds_min + 3, bounds_min_);
+    std::copy(cache.bounds_max, cache.bounds_max + 3, bounds_max_);
+    std::cout << "Loaded " << filename << " from " << mesh_cache_path(filename) << ": " << vertex_count_
+              << " verts, " << face_count_ << " faces in " << elapsed_ms() << " ms" << std::endl;
+    return;
+  }
+
+  auto owned = std::make_shared<Owned>();
+  ObjMesh& mesh = owned->obj;
+  mesh = load_obj(filename);
+  double parse_ms = elapsed_ms();
+  // Only positions are drawn
+  mesh.texcoords = std::vector<float>();
+  mesh.normals = std::vector<float>();
+  mesh.texcoord_indices = std::vector<int32_t>();
+  mesh.normal_indices = std::vector<int32_t>();
+
+  double mb = mesh.bytes / 1e6;
+  adopt(owned);
+  save_cache();
+
+  std::cout << "Loaded " << filename << ": " << vertex_count_ << " verts, " << face_count_
+            << " faces, " << edge_count_ << " edges, " << mb << " MB in " << parse_ms << " ms ("
+            << mb/(parse_ms/1000) << " MB/s)" << std::endl;
+}
+
+GeoObject::GeoObject(const std::vector<float>& positions, const std::vector<uint32_t>& indices) {
+  auto owned = std::make_shared<Owned>();
+  owned->obj.positions = positions;
+  owned->obj.position_indices.assign(indices.begin(), indices.end());
+  adopt(owned);
+}
+
+void GeoObject::adopt(std::shared_ptr<Owned> owned) {
+  ObjMesh& mesh = owned->obj;
+  positions_ = mesh.positions.data();
+  // Never negative (the loader validates), so the same bits read unsigned
+  indices_ = reinterpret_cast<const uint32_t*>(mesh.position_indices.data());
+  vertex_count_ = mesh.positions.size() / 3;
+  face_count_ = mesh.triangle_count();
+  for (int k = 0; k < 3; k++) {
+    bounds_min_[k] = vertex_count_ ? positions_[k] : 0;
+    bounds_max_[k] = bounds_min_[k];
+  }
+  for (std::size_t i = 0; i < vertex_count_; i++) {
+    for (int k = 0; k < 3; k++) {
+      bounds_min_[k] = std::min(bounds_min_[k], positions_[3*i + k]);
+      bounds_max_[k] = std::max(bounds_max_[k], positions_[3*i + k]);
+    }
+  }
+
+  owned->edges = unique_edges(indices_, face_count_, vertex_count_);
+  edges_ = owned->edges.data();
+  edge_count_ = owned->edges.size() / 2;
+  owned->face_planes = compute_face_planes(positions_, indices_, face_count_);
+  face_planes_ = owned->face_planes.data();
+  owned->edge_faces = compute_edge_faces(indices_, face_count_, vertex_count_, edges_, edge_count_);
+  edge_faces_ = owned->edge_faces.data();
+  storage_ = owned;
+}
+
+float GeoObject::radius() const {
+  float r2 = 0;
+  for (int k = 0; k < 3; k++) {
+    float half = (bounds_max_[k] - bounds_min_[k]) / 2;
+    r2 += half*half;
+  }
+  return sqrtf(r2);
+}
+
+void GeoObject::save_cache() const {
+  MeshCache out;
+  out.positions = positions_;
+  out.indices = indices_;
+  out.edges = edges_;
+  out.face_planes = face_planes_;
+  out.edge_faces = edge_faces_;
+  out.vertex_count = vertex_count_;
+  out.face_count = face_count_;
+  out.edge_count = edge_count_;
+  std::copy(bounds_min_, bounds_min_ + 3, out.bounds_min);
+  std::copy(bounds_max_, bounds_max_ + 3, out.bounds_max);
+  out.optimized = optimized_;
+  write_mesh_cache(filename_, out);
+}
+
+void GeoObject::optimize(int cache_size) {
+  if (!optimized_) {
+    auto start = std::chrono::steady_clock::now();
+    double before = acmr(indices_, face_count_, vertex_count_, cache_size);
+
+    // Always copies, the arrays may be a read-only mapping
+    auto owned = std::make_shared<Owned>();
+    std::vector<uint32_t> order = tipsify(indices_, face_count_, vertex_count_, cache_size);
+    std::vector<uint32_t> remap = order_by_first_use(order.data(), order.size(), vertex_count_);
+    std::vector<float>& positions = owned->obj.positions;
+    positions.resize(3*vertex_count_);
+    for (std::size_t v = 0; v < vertex_count_; v++) {
+      std::copy(positions_ + 3*v, positions_ + 3*v + 3, positions.begin() + 3*remap[v]);
+    }
+    owned->obj.position_indices.assign(order.begin(), order.end());
+    adopt(owned);
+    optimized_ = true;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (!filename_.empty()) {
+      std::cout << "Optimized " << filename_ << ": ACMR " << before << " -> "
+                << acmr(indices_, face_count_, vertex_count_, cache_size) << " in " << ms << " ms" << std::endl;
+      save_cache();
+    }
+  }
+
+  soa_.x.resize(vertex_count_);
+  soa_.y.resize(vertex_count_);
+  soa_.z.resize(vertex_count_);
+  for (std::size_t i = 0; i < vertex_count_; i++) {
+    soa_.x[i] = positions_[3*i];
+    soa_.y[i] = positions_[3*i + 1];
+    soa_.z[i] = positions_[3*i + 2];
+  }
+}
+
+void GeoObject::compress() {
+  if (compact_ || !positions_) {
+    return;
+  }
+  auto compact = std::make_shared<CompactMesh>(compress_mesh(positions_, nullptr, vertex_count_, indices_, face_count_));
+
+  // Only the edge data is still needed from the old storage
+  auto owned = std::make_shared<Owned>();
+  owned->edges.assign(edges_, edges_ + 2*edge_count_);
+  owned->face_planes.assign(face_planes_, face_planes_ + 4*face_count_);
+  owned->edge_faces.assign(edge_faces_, edge_faces_ + 2*edge_count_);
+  edges_ = owned->edges.data();
+  face_planes_ = owned->face_planes.data();
+  edge_faces_ = owned->edge_faces.data();
+  storage_ = owned;
+  positions_ = nullptr;
+  indices_ = nullptr;
+  soa_ = Soa();
+  compact_ = compact;
+}
+
+std::size_t GeoObject::bytes() const {
+  std::size_t total = 3*sizeof(float)*soa_.x.size() + 2*sizeof(uint32_t)*edge_count_;
+  if (compact_) {
+    total += compact_->bytes();
+  }
+  if (positions_) {
+    total += 3*sizeof(float)*vertex_count_;
+  }
+  if (indices_) {
+    total += 3*sizeof(uint32_t)*face_count_;
+  }
+  if (face_planes_) {
+    total += 4*sizeof(float)*face_count_;
+  }
+  if (edge_faces_) {
+    total += 2*sizeof(uint32_t)*edge_count_;
+  }
+  return total;
+}
 
-  while (!file.eof()) {
-    file >> leader;
-    if (leader == "v") {
-      file >> a >> b >> c;
-      verts_.push_back(Vertex(a, b, c));
-    } else if (leader == "f") {
-      file >> x >> y >> z;
-      faces_.push_back(Face(x, y, z));
-    } else {
-      //assert(false);
+// Edges are bucketed by their lower vertex, so weeding out the copies only
+// ever sorts a vertex's handful of neighbours
+std::vector<uint32_t> GeoObject::unique_edges(const uint32_t* indices, std::size_t face_count,
+                                              std::size_t vertex_count) {
+  std::vector<uint32_t> start(vertex_count + 1, 0);
+  for (std::size_t i = 0; i < 3*face_count; i++) {
+    uint32_t a = indices[i], b = indices[i - i%3 + (i+1)%3];
+    if (a != b) {
+      start[std::min(a, b) + 1]++;
     }
+  }
+  for (std::size_t v = 0; v < vertex_count; v++) {
+    start[v+1] += start[v];
+  }
+
+  std::vector<uint32_t> highs(start.back());
+  std::vector<uint32_t> cursor(start.begin(), start.end() - 1);
+  for (std::size_t i = 0; i < 3*face_count; i++) {
+    uint32_t a = indices[i], b = indices[i - i%3 + (i+1)%3];
+    if (a != b) {
+      highs[cursor[std::min(a, b)]++] = std::max(a, b);
+    }
+  }
+
+  std::vector<uint32_t> edges;
+  edges.reserve(highs.size());
+  for (std::size_t v = 0; v < vertex_count; v++) {
+    auto first = highs.begin() + start[v], last = highs.begin() + start[v+1];
+    std::sort(first, last);
+    last = std::unique(first, last);
+    for (auto it = first; it != last; ++it) {
+      edges.push_back(v);
+      edges.push_back(*it);
+    }
+  }
+  return edges;
+}
+
+std::size_t GeoObject::classify(const float eye[3], WireMode mode) const {
+  // Facing the eye when it's on the positive side of the face's plane
+  front_.resize(face_count_);
+  const float* p = face_planes_;
+  for (std::size_t f = 0; f < face_count_; f++, p += 4) {
+    front_[f] = p[0]*eye[0] + p[1]*eye[1] + p[2]*eye[2] + p[3] > 0;
+  }
 
+  visible_.clear();
+  for (std::size_t e = 0; e < edge_count_; e++) {
+    uint32_t f0 = edge_faces_[2*e], f1 = edge_faces_[2*e + 1];
+    bool a = f0 != UINT32_MAX && front_[f0];
+    bool b = f1 != UINT32_MAX && front_[f1];
+    // An open boundary is part of the outline whichever way its face points
+    bool open = f0 == UINT32_MAX || f1 == UINT32_MAX;
+    if (mode == WIRE_SILHOUETTE ? open || a != b : a || b) {
+      visible_.push_back(edges_[2*e]);
+      visible_.push_back(edges_[2*e + 1]);
+    }
   }
+  return visible_.size() / 2;
 }
 
+// One batch straight from the arrays, each edge once
 void GeoObject::draw() {
-  for (auto f: faces_) {
-    const Vertex& v1 = verts_[std::get<0>(f) - 1];
-    const Vertex& v2 = verts_[std::get<1>(f) - 1];
-    const Vertex& v3 = verts_[std::get<2>(f) - 1];
+  PROFILE_SCOPE("GeoObject::draw");
+  if (edge_count_ == 0) {
+    return;
+  }
+  const uint32_t* edges = edges_;
+  std::size_t count = edge_count_;
+  if (wire_mode_ != WIRE_ALL) {
+    // Eye in model space: solve M * eye = 0 through the modelview
+    GLfloat m[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX, m);
+    float det = m[0]*(m[5]*m[10] - m[9]*m[6]) - m[4]*(m[1]*m[10] - m[9]*m[2]) + m[8]*(m[1]*m[6] - m[5]*m[2]);
+    if (det != 0) {
+      float t[3] = {-m[12], -m[13], -m[14]};
+      float eye[3] = {
+        (t[0]*(m[5]*m[10] - m[9]*m[6]) - m[4]*(t[1]*m[10] - m[9]*t[2]) + m[8]*(t[1]*m[6] - m[5]*t[2])) / det,
+        (m[0]*(t[1]*m[10] - m[9]*t[2]) - t[0]*(m[1]*m[10] - m[9]*m[2]) + m[8]*(m[1]*t[2] - t[1]*m[2])) / det,
+        (m[0]*(m[5]*t[2] - t[1]*m[6]) - m[4]*(m[1]*t[2] - t[1]*m[2]) + t[0]*(m[1]*m[6] - m[5]*m[2])) / det,
+      };
+      count = classify(eye, wire_mode_);
+      edges = visible_.data();
+    }
+  }
+  if (count == 0) {
+    return;
+  }
 
-    glBegin(GL_LINE_LOOP);
-    glVertex3d(std::get<0>(v1), std::get<1>(v1), std::get<2>(v1));
-    glVertex3d(std::get<0>(v2), std::get<1>(v2), std::get<2>(v2));
-    glVertex3d(std::get<0>(v3), std::get<1>(v3), std::get<2>(v3));
-    glEnd();
+  glEnableClientState(GL_VERTEX_ARRAY);
+  if (compact_) {
+    // GL dequantizes for us as part of the modelview transform
+    glPushMatrix();
+    glTranslatef(compact_->center[0], compact_->center[1], compact_->center[2]);
+    glScalef(compact_->step[0], compact_->step[1], compact_->step[2]);
+    glVertexPointer(3, GL_SHORT, 0, compact_->positions.data());
+    glDrawElements(GL_LINES, 2*count, GL_UNSIGNED_INT, edges);
+    glPopMatrix();
+  } else {
+    glVertexPointer(3, GL_FLOAT, 0, positions_);
+    glDrawElements(GL_LINES, 2*count, GL_UNSIGNED_INT, edges);
   }
+  glDisableClientState(GL_VERTEX_ARRAY);
 }
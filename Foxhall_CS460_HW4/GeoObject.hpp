@@ -1,18 +1,92 @@
 #ifndef GEO_OBJECT_H_
 #define GEO_OBJECT_H_
 
+#include "CompactMesh.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 class GeoObject {
-  using Vertex = std::tuple<double, double, double>;
-  using Face = std::tuple<int, int, int>;
   public:
     GeoObject() = default;
     GeoObject(std::string);
+    // From a mesh built in memory, not cached
+    GeoObject(const std::vector<float>& positions, const std::vector<uint32_t>& indices);
+    // Which edges draw() submits. Front keeps edges with a face towards the
+    // eye (silhouettes included), silhouette keeps only the outline: edges
+    // where front meets back, and every open boundary.
+    enum WireMode { WIRE_ALL, WIRE_FRONT, WIRE_SILHOUETTE };
     void draw();
+    void set_wire_mode(WireMode mode) { wire_mode_ = mode; }
+    WireMode wire_mode() const { return wire_mode_; }
+    // Picks the edges to draw for an eye at `eye` in model space, returns
+    // how many. They're left in visible_edges().
+    std::size_t classify(const float eye[3], WireMode mode) const;
+    const std::vector<uint32_t>& visible_edges() const { return visible_; }
+    // Reorders triangles and vertices for the post-transform cache and fills
+    // soa(). Saved back to the mesh cache, so it's only done once per file.
+    void optimize(int cache_size = 16);
+    // Swaps the float positions and index buffer for a CompactMesh and draws
+    // from 16-bit positions, which GL scales back as part of the modelview.
+    // positions(), indices() and soa() are empty afterwards; the wireframe
+    // only needs edges(), and the faces are in decode_indices(*compact()).
+    // Best done after optimize().
+    void compress();
+    // Memory held for the mesh: positions, faces, edges, face planes and
+    // edge faces, whichever form they're in
+    std::size_t bytes() const;
+
+    static std::vector<uint32_t> unique_edges(const uint32_t* indices, std::size_t face_count,
+                                              std::size_t vertex_count);
+
+    std::size_t vertex_count() const { return vertex_count_; }
+    std::size_t face_count() const { return face_count_; }
+    const float* positions() const { return positions_; }
+    const uint32_t* indices() const { return indices_; }
+    std::size_t edge_count() const { return edge_count_; }
+    const uint32_t* edges() const { return edges_; }
+    const float* face_planes() const { return face_planes_; }
+    const uint32_t* edge_faces() const { return edge_faces_; }
+    bool optimized() const { return optimized_; }
+    const float* bounds_min() const { return bounds_min_; }
+    const float* bounds_max() const { return bounds_max_; }
+    // Half the bounding box diagonal
+    float radius() const;
+
+    // Positions split by coordinate for CPU passes, empty until optimize().
+    // GL still gets the interleaved array.
+    struct Soa {
+      std::vector<float> x, y, z;
+    };
+    const Soa& soa() const { return soa_; }
+    const CompactMesh* compact() const { return compact_.get(); }
   private:
-    std::vector<Vertex> verts_;
-    std::vector<Face> faces_;
+    // Keeps alive whatever the arrays below point into, either this or a
+    // mapped mesh cache
+    struct Owned;
+    void adopt(std::shared_ptr<Owned> owned);
+    void save_cache() const;
+    std::shared_ptr<const void> storage_;
+    const float* positions_ = nullptr;  // x y z
+    const uint32_t* indices_ = nullptr; // three per face, 0-based
+    const uint32_t* edges_ = nullptr;   // two per edge, each shared edge once
+    const float* face_planes_ = nullptr;     // a b c d per face, unit normal
+    const uint32_t* edge_faces_ = nullptr;   // two per edge, UINT32_MAX if open
+    std::size_t vertex_count_ = 0;
+    std::size_t face_count_ = 0;
+    std::size_t edge_count_ = 0;
+    float bounds_min_[3] = {0, 0, 0};
+    float bounds_max_[3] = {0, 0, 0};
+    std::string filename_;
+    bool optimized_ = false;
+    Soa soa_;
+    std::shared_ptr<const CompactMesh> compact_;
+    WireMode wire_mode_ = WIRE_ALL;
+    // Per-frame scratch for classify()
+    mutable std::vector<uint8_t> front_;
+    mutable std::vector<uint32_t> visible_;
 };
 
 #endif
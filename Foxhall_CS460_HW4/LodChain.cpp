@@ -0,0 +1,40 @@
+#include "LodChain.hpp"
+#include "Simplify.hpp"
+
+#include <chrono>
+#include <iostream>
+
+LodChain::LodChain(const GeoObject& base, std::size_t min_faces, int max_levels) {
+  levels_.push_back(base);
+  errors_.push_back(0);
+  if (!base.positions()) {
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::size_t> targets;
+  for (std::size_t faces = base.face_count() / 4; faces >= min_faces && static_cast<int>(targets.size()) + 1 < max_levels; faces /= 4) {
+    targets.push_back(faces);
+  }
+  auto simplified = simplify(base.positions(), base.vertex_count(), base.indices(), base.face_count(), targets);
+  for (auto& mesh: simplified) {
+    levels_.push_back(GeoObject(mesh.positions, mesh.indices));
+    levels_.back().optimize();
+    errors_.push_back(mesh.error);
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Built " << levels_.size() - 1 << " LODs in " << ms << " ms:";
+  for (auto& level: levels_) {
+    std::cout << " " << level.face_count();
+  }
+  std::cout << " faces" << std::endl;
+}
+
+std::size_t LodChain::pick(double pixels_per_unit, double tolerance) const {
+  std::size_t i = 0;
+  while (i + 1 < levels_.size() && errors_[i + 1] * pixels_per_unit <= tolerance) {
+    i++;
+  }
+  return i;
+}
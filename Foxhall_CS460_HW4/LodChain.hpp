@@ -0,0 +1,28 @@
+#ifndef LOD_CHAIN_H_
+#define LOD_CHAIN_H_
+
+#include "GeoObject.hpp"
+
+#include <vector>
+
+// A mesh and simplified copies of it, each with about a quarter of the
+// faces of the one before. Level 0 is the original.
+class LodChain {
+  public:
+    LodChain() = default;
+    // Stops at `min_faces` or after `max_levels` levels
+    explicit LodChain(const GeoObject& base, std::size_t min_faces = 256, int max_levels = 6);
+
+    // Coarsest level whose error stays under `tolerance` pixels when one
+    // model unit covers `pixels_per_unit` on screen
+    std::size_t pick(double pixels_per_unit, double tolerance = 1.0) const;
+
+    std::size_t size() const { return levels_.size(); }
+    GeoObject& operator[](std::size_t i) { return levels_[i]; }
+    float error(std::size_t i) const { return errors_[i]; }
+  private:
+    std::vector<GeoObject> levels_;
+    std::vector<float> errors_; // model units
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <string>
+#include <cstddef>
+
+// Read-only mmap of a whole file, unmapped when it goes out of scope
+class MappedFile {
+  public:
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+  private:
+    const char* data_;
+    std::size_t size_;
+};
+
+#endif
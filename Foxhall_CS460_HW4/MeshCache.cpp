@@ -0,0 +1,197 @@
+#include "MeshCache.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+namespace {
+  const char kMagic[8] = {'G', 'E', 'O', 'M', 'E', 'S', 'H', '\0'};
+  const uint32_t kVersion = 4;
+  const uint64_t kAlign = 64;
+  const uint64_t kOptimized = 1;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t flags;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    uint64_t vertex_count;
+    uint64_t face_count;
+    uint64_t edge_count;
+    uint64_t vertex_offset;
+    uint64_t face_offset;
+    uint64_t edge_offset;
+    uint64_t plane_offset;
+    uint64_t edge_face_offset;
+    float bounds_min[3];
+    float bounds_max[3];
+  };
+
+  // Whether `count` elements of `size` bytes at `offset` fit in a file of
+  // `file_size` bytes, without overflowing on a corrupt header
+  bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+    return offset % kAlign == 0 && offset <= file_size && count <= (file_size - offset) / size;
+  }
+
+  // Whether every value is below `limit`, letting UINT32_MAX through when
+  // allow_open (the missing face of an open edge)
+  bool all_below(const uint32_t *values, std::size_t n, uint64_t limit, bool allow_open = false) {
+    for (std::size_t i = 0; i < n; i++) {
+      if (values[i] >= limit && !(allow_open && values[i] == UINT32_MAX)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint64_t align(uint64_t n) {
+    return (n + kAlign - 1) / kAlign * kAlign;
+  }
+
+  bool stat_source(const std::string& source, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(source.c_str(), &st) < 0) {
+      return false;
+    }
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+  }
+
+  // FNV-1a over 8 byte words
+  uint64_t hash_file(const std::string& source) {
+    MappedFile file(source);
+    const char *p = file.data();
+    std::size_t n = file.size();
+    uint64_t h = 14695981039346656037ull;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t word;
+      std::memcpy(&word, p + i, 8);
+      h = (h ^ word) * 1099511628211ull;
+    }
+    for (; i < n; i++) {
+      h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ull;
+    }
+    return h;
+  }
+}
+
+std::string mesh_cache_path(const std::string& source) {
+  return source + ".meshcache";
+}
+
+bool read_mesh_cache(const std::string& source, MeshCache& out) {
+  uint64_t size;
+  int64_t mtime;
+  if (!stat_source(source, size, mtime)) {
+    return false;
+  }
+
+  std::shared_ptr<MappedFile> file;
+  try {
+    file = std::make_shared<MappedFile>(mesh_cache_path(source));
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+
+  Header h;
+  if (file->size() < sizeof(h)) {
+    return false;
+  }
+  std::memcpy(&h, file->data(), sizeof(h));
+  if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion ||
+      h.header_size != sizeof(h) || h.source_size != size) {
+    return false;
+  }
+  if (h.source_mtime != mtime && h.source_hash != hash_file(source)) {
+    return false;
+  }
+  uint64_t file_size = file->size();
+  if (!fits(h.vertex_offset, h.vertex_count, 12, file_size) || !fits(h.face_offset, h.face_count, 12, file_size) ||
+      !fits(h.edge_offset, h.edge_count, 8, file_size) || !fits(h.plane_offset, h.face_count, 16, file_size) ||
+      !fits(h.edge_face_offset, h.edge_count, 8, file_size)) {
+    return false;
+  }
+  // A corrupt cache mustn't send anything past the end of the arrays
+  const char *data = file->data();
+  if (!all_below(reinterpret_cast<const uint32_t *>(data + h.face_offset), 3*h.face_count, h.vertex_count) ||
+      !all_below(reinterpret_cast<const uint32_t *>(data + h.edge_offset), 2*h.edge_count, h.vertex_count) ||
+      !all_below(reinterpret_cast<const uint32_t *>(data + h.edge_face_offset), 2*h.edge_count, h.face_count,
+                 true)) {
+    return false;
+  }
+  if (h.source_mtime != mtime) {
+    // Touched or checked out again with the same contents: record the new
+    // mtime so the next load doesn't hash the source again
+    std::fstream header(mesh_cache_path(source), std::ios::in | std::ios::out | std::ios::binary);
+    header.seekp(offsetof(Header, source_mtime));
+    header.write(reinterpret_cast<const char *>(&mtime), sizeof(mtime));
+  }
+
+  out.file = file;
+  out.positions = reinterpret_cast<const float *>(file->data() + h.vertex_offset);
+  out.indices = reinterpret_cast<const uint32_t *>(file->data() + h.face_offset);
+  out.edges = reinterpret_cast<const uint32_t *>(file->data() + h.edge_offset);
+  out.face_planes = reinterpret_cast<const float *>(file->data() + h.plane_offset);
+  out.edge_faces = reinterpret_cast<const uint32_t *>(file->data() + h.edge_face_offset);
+  out.vertex_count = h.vertex_count;
+  out.face_count = h.face_count;
+  out.edge_count = h.edge_count;
+  out.optimized = h.flags & kOptimized;
+  std::memcpy(out.bounds_min, h.bounds_min, sizeof(h.bounds_min));
+  std::memcpy(out.bounds_max, h.bounds_max, sizeof(h.bounds_max));
+  return true;
+}
+
+void write_mesh_cache(const std::string& source, const MeshCache& mesh) {
+  Header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kVersion;
+  h.header_size = sizeof(h);
+  h.flags = mesh.optimized ? kOptimized : 0;
+  if (!stat_source(source, h.source_size, h.source_mtime)) {
+    return;
+  }
+  h.source_hash = hash_file(source);
+  h.vertex_count = mesh.vertex_count;
+  h.face_count = mesh.face_count;
+  h.edge_count = mesh.edge_count;
+  h.vertex_offset = align(sizeof(h));
+  h.face_offset = align(h.vertex_offset + 12*h.vertex_count);
+  h.edge_offset = align(h.face_offset + 12*h.face_count);
+  h.plane_offset = align(h.edge_offset + 8*h.edge_count);
+  h.edge_face_offset = align(h.plane_offset + 16*h.face_count);
+  std::memcpy(h.bounds_min, mesh.bounds_min, sizeof(h.bounds_min));
+  std::memcpy(h.bounds_max, mesh.bounds_max, sizeof(h.bounds_max));
+
+  // Written aside and renamed so a half-written cache is never picked up
+  std::string path = mesh_cache_path(source);
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary);
+  const char zeros[kAlign] = {};
+  auto write_at = [&](uint64_t offset, const void *data, uint64_t bytes) {
+    out.write(zeros, offset - out.tellp());
+    out.write(static_cast<const char *>(data), bytes);
+  };
+  write_at(0, &h, sizeof(h));
+  write_at(h.vertex_offset, mesh.positions, 12*h.vertex_count);
+  write_at(h.face_offset, mesh.indices, 12*h.face_count);
+  write_at(h.edge_offset, mesh.edges, 8*h.edge_count);
+  write_at(h.plane_offset, mesh.face_planes, 16*h.face_count);
+  write_at(h.edge_face_offset, mesh.edge_faces, 8*h.edge_count);
+  out.close();
+  if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    std::cerr << "Could not write mesh cache " << path << std::endl;
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Binary copy of a parsed mesh kept next to its source as <source>.meshcache.
+// Arrays are 64-byte aligned in the file so they can be used straight out of
+// the mapping. A cache is used when the source's size and mtime match, or if
+// the mtime moved but the contents still hash the same.
+struct MeshCache {
+  std::shared_ptr<MappedFile> file;
+  const float *positions;   // x y z
+  const uint32_t *indices;  // three per triangle
+  const uint32_t *edges;    // two per unique edge
+  const float *face_planes; // a b c d per triangle, unit normal
+  const uint32_t *edge_faces; // the two faces on each edge, UINT32_MAX for none
+  std::size_t vertex_count;
+  std::size_t face_count;
+  std::size_t edge_count;
+  float bounds_min[3];
+  float bounds_max[3];
+  bool optimized;           // triangles and vertices already in cache order
+};
+
+std::string mesh_cache_path(const std::string& source);
+
+// False if there's no usable cache for `source`
+bool read_mesh_cache(const std::string& source, MeshCache& out);
+
+// Best effort, a read-only directory just means no cache. mesh.file is ignored.
+void write_mesh_cache(const std::string& source, const MeshCache& mesh);
+
+#endif
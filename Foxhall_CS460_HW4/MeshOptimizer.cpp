@@ -0,0 +1,123 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+
+std::vector<uint32_t> tipsify(const uint32_t *indices, std::size_t face_count,
+                              std::size_t vertex_count, int cache_size) {
+  // Triangles around each vertex
+  std::vector<uint32_t> start(vertex_count + 1, 0);
+  for (std::size_t i = 0; i < 3*face_count; i++) {
+    start[indices[i] + 1]++;
+  }
+  for (std::size_t v = 0; v < vertex_count; v++) {
+    start[v+1] += start[v];
+  }
+  std::vector<uint32_t> adjacency(3*face_count);
+  std::vector<uint32_t> cursor(start.begin(), start.end() - 1);
+  for (std::size_t i = 0; i < 3*face_count; i++) {
+    adjacency[cursor[indices[i]]++] = i / 3;
+  }
+
+  std::vector<int> live(vertex_count);
+  for (std::size_t v = 0; v < vertex_count; v++) {
+    live[v] = start[v+1] - start[v];
+  }
+  std::vector<long> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(face_count, false);
+  std::vector<uint32_t> dead_end;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> out;
+  out.reserve(3*face_count);
+
+  long time = cache_size + 1;
+  std::size_t scan = 0;
+  long fan = vertex_count ? 0 : -1;
+  while (fan >= 0) {
+    // Emit everything still around the fanning vertex
+    candidates.clear();
+    for (uint32_t k = start[fan]; k < start[fan+1]; k++) {
+      uint32_t t = adjacency[k];
+      if (emitted[t]) {
+        continue;
+      }
+      for (int c = 0; c < 3; c++) {
+        uint32_t v = indices[3*t + c];
+        out.push_back(v);
+        dead_end.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > cache_size) {
+          cache_time[v] = time++;
+        }
+      }
+      emitted[t] = true;
+    }
+
+    // Next fan: the candidate still in cache with the most left to do
+    fan = -1;
+    long best = -1;
+    for (uint32_t v: candidates) {
+      if (live[v] > 0) {
+        long priority = 0;
+        if (time - cache_time[v] + 2*live[v] <= cache_size) {
+          priority = time - cache_time[v];
+        }
+        if (priority > best) {
+          best = priority;
+          fan = v;
+        }
+      }
+    }
+    // Otherwise backtrack through recent vertices, then scan forward
+    while (fan < 0 && !dead_end.empty()) {
+      uint32_t v = dead_end.back();
+      dead_end.pop_back();
+      if (live[v] > 0) {
+        fan = v;
+      }
+    }
+    for (; fan < 0 && scan < vertex_count; scan++) {
+      if (live[scan] > 0) {
+        fan = scan;
+      }
+    }
+  }
+  return out;
+}
+
+std::vector<uint32_t> order_by_first_use(uint32_t *indices, std::size_t index_count,
+                                         std::size_t vertex_count) {
+  const uint32_t unused = UINT32_MAX;
+  std::vector<uint32_t> remap(vertex_count, unused);
+  uint32_t next = 0;
+  for (std::size_t i = 0; i < index_count; i++) {
+    uint32_t& r = remap[indices[i]];
+    if (r == unused) {
+      r = next++;
+    }
+    indices[i] = r;
+  }
+  for (auto& r: remap) {
+    if (r == unused) {
+      r = next++;
+    }
+  }
+  return remap;
+}
+
+double acmr(const uint32_t *indices, std::size_t face_count, std::size_t vertex_count,
+            int cache_size) {
+  if (face_count == 0) {
+    return 0;
+  }
+  // FIFO: a vertex is a hit if it went in less than cache_size misses ago
+  std::vector<long> entered(vertex_count, -1);
+  long misses = 0;
+  for (std::size_t i = 0; i < 3*face_count; i++) {
+    long& e = entered[indices[i]];
+    if (e < 0 || misses - e >= cache_size) {
+      e = misses++;
+    }
+  }
+  return static_cast<double>(misses) / face_count;
+}
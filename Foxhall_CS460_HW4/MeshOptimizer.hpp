@@ -0,0 +1,24 @@
+#ifndef MESH_OPTIMIZER_H_
+#define MESH_OPTIMIZER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Triangle order for a FIFO post-transform vertex cache of `cache_size`
+// entries, using Tipsify (Sander, Nehab and Barczak 2007). Returns the
+// reordered index buffer.
+std::vector<uint32_t> tipsify(const uint32_t *indices, std::size_t face_count,
+                              std::size_t vertex_count, int cache_size = 16);
+
+// Renumbers vertices in the order the index buffer first uses them, rewriting
+// `indices` in place. Unused vertices go last. Returns new id for each old id.
+std::vector<uint32_t> order_by_first_use(uint32_t *indices, std::size_t index_count,
+                                         std::size_t vertex_count);
+
+// Average cache miss ratio: vertices transformed per triangle with a FIFO
+// cache of `cache_size`. 3 is no reuse at all, ~0.5 is ideal for big meshes.
+double acmr(const uint32_t *indices, std::size_t face_count, std::size_t vertex_count,
+            int cache_size = 16);
+
+#endif
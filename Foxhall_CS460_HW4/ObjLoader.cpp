@@ -0,0 +1,318 @@
+#include "ObjLoader.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+  // What one thread pulls out of its slice of the file. Negative (relative)
+  // indices can point before the slice, so they're resolved while merging and
+  // the slots holding them are remembered here.
+  struct Chunk {
+    ObjMesh mesh;
+    std::vector<std::size_t> relative[3];
+    std::size_t offsets[3];
+    bool bad_index = false;
+  };
+
+  const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+
+  inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  inline const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) {
+      p++;
+    }
+    return p;
+  }
+
+  // Digits go into a 64-bit mantissa and get scaled once at the end, good
+  // enough for anything that ends up in a float
+  const char* parse_float(const char* p, const char* end, float& out) {
+    p = skip_space(p, end);
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      neg = *p == '-';
+      p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    for (; p < end && is_digit(*p); p++) {
+      if (digits < 19) {
+        mantissa = mantissa*10 + (*p - '0');
+        digits += mantissa != 0;
+      } else {
+        exponent++;
+      }
+    }
+    if (p < end && *p == '.') {
+      for (p++; p < end && is_digit(*p); p++) {
+        if (digits < 19) {
+          mantissa = mantissa*10 + (*p - '0');
+          digits += mantissa != 0;
+          exponent--;
+        }
+      }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      p++;
+      bool exp_neg = false;
+      if (p < end && (*p == '-' || *p == '+')) {
+        exp_neg = *p == '-';
+        p++;
+      }
+      int e = 0;
+      for (; p < end && is_digit(*p); p++) {
+        e = std::min(e*10 + (*p - '0'), 1000);
+      }
+      exponent += exp_neg ? -e : e;
+    }
+
+    double value = mantissa;
+    for (; exponent > 22; exponent -= 22) {
+      value *= 1e22;
+    }
+    for (; exponent < -22; exponent += 22) {
+      value /= 1e22;
+    }
+    value = exponent < 0 ? value / kPow10[-exponent] : value * kPow10[exponent];
+    out = neg ? -value : value;
+    return p;
+  }
+
+  // Returns p unchanged if there was no number
+  const char* parse_int(const char* p, const char* end, int32_t& out) {
+    const char* start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      neg = *p == '-';
+      p++;
+    }
+    if (p == end || !is_digit(*p)) {
+      return start;
+    }
+    int64_t value = 0;
+    for (; p < end && is_digit(*p); p++) {
+      value = std::min<int64_t>(value*10 + (*p - '0'), INT32_MAX);
+    }
+    out = neg ? -value : value;
+    return p;
+  }
+
+  const char* parse_floats(const char* p, const char* end, std::vector<float>& out, int n) {
+    for (int i = 0; i < n; i++) {
+      float f = 0;
+      p = parse_float(p, end, f);
+      out.push_back(f);
+    }
+    return p;
+  }
+
+  // v/vt/vn, v//vn, v/vt or v. Fills -1 for what's missing, flags relative
+  // indices and turns absolute ones 0-based.
+  const char* parse_corner(const char* p, const char* end, Chunk& chunk,
+                           int32_t corner[3], bool relative[3]) {
+    std::size_t counts[] = {
+      chunk.mesh.positions.size() / 3,
+      chunk.mesh.texcoords.size() / 2,
+      chunk.mesh.normals.size() / 3,
+    };
+    for (int k = 0; k < 3; k++) {
+      corner[k] = -1;
+      relative[k] = false;
+    }
+    for (int k = 0; k < 3; k++) {
+      if (k > 0) {
+        if (p == end || *p != '/') {
+          break;
+        }
+        p++;
+      }
+
+      int32_t idx;
+      const char* next = parse_int(p, end, idx);
+      if (next == p) {
+        continue;
+      }
+      p = next;
+      if (idx > 0) {
+        corner[k] = idx - 1;
+      } else if (idx < 0) {
+        corner[k] = static_cast<int32_t>(counts[k]) + idx;
+        relative[k] = true;
+      } else {
+        chunk.bad_index = true;
+      }
+    }
+    return p;
+  }
+
+  void parse_chunk(const char* p, const char* end, Chunk& chunk) {
+    ObjMesh& mesh = chunk.mesh;
+    std::vector<int32_t> corners;
+    std::vector<char> corner_relative;
+
+    while (p < end) {
+      const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (!eol) {
+        eol = end;
+      }
+      p = skip_space(p, eol);
+      if (eol - p >= 2 && p[0] == 'v') {
+        if (is_space(p[1])) {
+          parse_floats(p + 1, eol, mesh.positions, 3);
+        } else if (p[1] == 't' && (eol - p == 2 || is_space(p[2]))) {
+          parse_floats(p + 2, eol, mesh.texcoords, 2);
+        } else if (p[1] == 'n' && (eol - p == 2 || is_space(p[2]))) {
+          parse_floats(p + 2, eol, mesh.normals, 3);
+        }
+      } else if (eol - p >= 2 && p[0] == 'f' && is_space(p[1])) {
+        corners.clear();
+        corner_relative.clear();
+        for (p = skip_space(p + 1, eol); p < eol; p = skip_space(p, eol)) {
+          int32_t corner[3];
+          bool relative[3];
+          const char* next = parse_corner(p, eol, chunk, corner, relative);
+          if (next == p) {
+            break;
+          }
+          p = next;
+          corners.insert(corners.end(), corner, corner + 3);
+          corner_relative.insert(corner_relative.end(), relative, relative + 3);
+        }
+
+        // Fan around the first corner
+        std::size_t n = corners.size() / 3;
+        for (std::size_t i = 1; i + 1 < n; i++) {
+          std::size_t tri[] = {0, i, i + 1};
+          for (std::size_t c: tri) {
+            std::vector<int32_t>* arrays[] = {
+              &mesh.position_indices, &mesh.texcoord_indices, &mesh.normal_indices,
+            };
+            for (int k = 0; k < 3; k++) {
+              if (corner_relative[3*c + k]) {
+                chunk.relative[k].push_back(arrays[k]->size());
+              }
+              arrays[k]->push_back(corners[3*c + k]);
+            }
+          }
+        }
+      }
+      p = eol + 1;
+    }
+  }
+
+  template <class T>
+  void place(const std::vector<T>& src, std::vector<T>& dst, std::size_t at) {
+    std::copy(src.begin(), src.end(), dst.begin() + at);
+  }
+
+  // Copies a chunk into the final arrays, resolves its relative indices and
+  // checks everything is in range
+  void merge_chunk(Chunk& chunk, ObjMesh& out, const std::size_t counts[3]) {
+    ObjMesh& mesh = chunk.mesh;
+    place(mesh.positions, out.positions, 3*chunk.offsets[0]);
+    place(mesh.texcoords, out.texcoords, 2*chunk.offsets[1]);
+    place(mesh.normals, out.normals, 3*chunk.offsets[2]);
+
+    std::vector<int32_t>* arrays[] = {
+      &mesh.position_indices, &mesh.texcoord_indices, &mesh.normal_indices,
+    };
+    for (int k = 0; k < 3; k++) {
+      auto& idx = *arrays[k];
+      for (auto slot: chunk.relative[k]) {
+        idx[slot] += chunk.offsets[k];
+      }
+      for (auto i: idx) {
+        // Positions are mandatory, the rest may be -1
+        if (i >= static_cast<int64_t>(counts[k]) || i < (k == 0 ? 0 : -1)) {
+          chunk.bad_index = true;
+        }
+      }
+    }
+  }
+}
+
+ObjMesh load_obj(const std::string& filename, unsigned threads) {
+  MappedFile file(filename);
+  const char* begin = file.data();
+  const char* end = begin + file.size();
+
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Not worth a thread for less than a megabyte
+  std::size_t n = std::max<std::size_t>(1, std::min<std::size_t>(threads, file.size() >> 20));
+
+  // Slice on line boundaries
+  std::vector<const char*> cuts{begin};
+  for (std::size_t i = 1; i < n; i++) {
+    const char* p = std::max(cuts.back(), begin + file.size()*i/n);
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    cuts.push_back(eol ? eol + 1 : end);
+  }
+  cuts.push_back(end);
+
+  std::vector<Chunk> chunks(n);
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < n; i++) {
+    workers.emplace_back(parse_chunk, cuts[i], cuts[i+1], std::ref(chunks[i]));
+  }
+  parse_chunk(cuts[0], cuts[1], chunks[0]);
+  for (auto& w: workers) {
+    w.join();
+  }
+  workers.clear();
+
+  std::size_t counts[3] = {0, 0, 0};
+  std::size_t tri_indices = 0;
+  for (auto& c: chunks) {
+    std::size_t sizes[] = {
+      c.mesh.positions.size() / 3, c.mesh.texcoords.size() / 2, c.mesh.normals.size() / 3,
+    };
+    for (int k = 0; k < 3; k++) {
+      c.offsets[k] = counts[k];
+      counts[k] += sizes[k];
+    }
+    tri_indices += c.mesh.position_indices.size();
+  }
+
+  ObjMesh out;
+  out.bytes = file.size();
+  out.positions.resize(3*counts[0]);
+  out.texcoords.resize(2*counts[1]);
+  out.normals.resize(3*counts[2]);
+  for (std::size_t i = 1; i < n; i++) {
+    workers.emplace_back(merge_chunk, std::ref(chunks[i]), std::ref(out), counts);
+  }
+  merge_chunk(chunks[0], out, counts);
+  for (auto& w: workers) {
+    w.join();
+  }
+
+  out.position_indices.reserve(tri_indices);
+  out.texcoord_indices.reserve(tri_indices);
+  out.normal_indices.reserve(tri_indices);
+  for (auto& c: chunks) {
+    if (c.bad_index) {
+      throw std::runtime_error(filename + ": face index out of range");
+    }
+    auto& m = c.mesh;
+    out.position_indices.insert(out.position_indices.end(), m.position_indices.begin(), m.position_indices.end());
+    out.texcoord_indices.insert(out.texcoord_indices.end(), m.texcoord_indices.begin(), m.texcoord_indices.end());
+    out.normal_indices.insert(out.normal_indices.end(), m.normal_indices.begin(), m.normal_indices.end());
+  }
+  return out;
+}
@@ -0,0 +1,29 @@
+#ifndef OBJ_LOADER_H_
+#define OBJ_LOADER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Everything in a Wavefront OBJ that's useful without materials. Polygons
+// are fanned into triangles, so every index array holds three entries per
+// triangle. Indices are 0-based, -1 where a corner didn't give a texcoord or
+// normal.
+struct ObjMesh {
+  std::vector<float> positions; // x y z
+  std::vector<float> texcoords; // u v
+  std::vector<float> normals;   // x y z
+  std::vector<int32_t> position_indices;
+  std::vector<int32_t> texcoord_indices;
+  std::vector<int32_t> normal_indices;
+  std::size_t bytes = 0; // size of the file it came from
+
+  std::size_t triangle_count() const { return position_indices.size() / 3; }
+};
+
+// mmaps the file and parses it in chunks across `threads` threads, 0 picks
+// one per core. Throws std::runtime_error on unreadable files and
+// out-of-range indices.
+ObjMesh load_obj(const std::string& filename, unsigned threads = 0);
+
+#endif
@@ -0,0 +1,306 @@
+#include "Simplify.hpp"
+
+#include <algorithm>
+#include <queue>
+#include <math.h>
+
+namespace {
+  // Symmetric 4x4 as its upper triangle
+  struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+    void add_plane(double a, double b, double c, double d, double w) {
+      a2 += w*a*a; ab += w*a*b; ac += w*a*c; ad += w*a*d;
+      b2 += w*b*b; bc += w*b*c; bd += w*b*d;
+      c2 += w*c*c; cd += w*c*d;
+      d2 += w*d*d;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+      a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+      b2 += q.b2; bc += q.bc; bd += q.bd;
+      c2 += q.c2; cd += q.cd;
+      d2 += q.d2;
+      return *this;
+    }
+
+    double error(const double p[3]) const {
+      double x = p[0], y = p[1], z = p[2];
+      return a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x
+           + b2*y*y + 2*bc*y*z + 2*bd*y
+           + c2*z*z + 2*cd*z
+           + d2;
+    }
+
+    // Point of least error, false if the system is close to singular
+    bool minimum(double p[3]) const {
+      double det = a2*(b2*c2 - bc*bc) - ab*(ab*c2 - bc*ac) + ac*(ab*bc - b2*ac);
+      double scale = a2*b2*c2;
+      if (fabs(det) <= 1e-10 * std::max(fabs(scale), 1e-30)) {
+        return false;
+      }
+      p[0] = -(ad*(b2*c2 - bc*bc) - ab*(bd*c2 - bc*cd) + ac*(bd*bc - b2*cd)) / det;
+      p[1] = -(a2*(bd*c2 - cd*bc) - ad*(ab*c2 - bc*ac) + ac*(ab*cd - bd*ac)) / det;
+      p[2] = -(a2*(b2*cd - bc*bd) - ab*(ab*cd - bd*ac) + ad*(ab*bc - b2*ac)) / det;
+      return true;
+    }
+  };
+
+  struct Collapse {
+    double cost;
+    uint32_t keep, drop;
+    uint32_t keep_version, drop_version;
+    double target[3];
+    bool operator<(const Collapse& c) const { return cost > c.cost; } // min-heap
+  };
+
+  void normal(const double a[3], const double b[3], const double c[3], double n[3]) {
+    double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+  }
+
+  class Simplifier {
+    public:
+      Simplifier(const float *positions, std::size_t vertex_count, const uint32_t *indices, std::size_t face_count);
+      std::vector<SimplifiedMesh> run(const std::vector<std::size_t>& targets);
+    private:
+      void push_edge(uint32_t a, uint32_t b);
+      bool flips(uint32_t moved, uint32_t other, const double p[3]) const;
+      void collapse(const Collapse& c);
+      SimplifiedMesh snapshot() const;
+
+      std::vector<double> pos_;
+      std::vector<uint32_t> faces_;
+      std::vector<bool> face_alive_;
+      std::vector<std::vector<uint32_t> > vertex_faces_;
+      std::vector<Quadric> quadrics_;
+      std::vector<uint32_t> version_;
+      std::vector<bool> vertex_alive_;
+      std::priority_queue<Collapse> heap_;
+      std::size_t live_faces_;
+      double max_cost_ = 0;
+  };
+
+  Simplifier::Simplifier(const float *positions, std::size_t vertex_count, const uint32_t *indices,
+                         std::size_t face_count)
+    : pos_(positions, positions + 3*vertex_count), faces_(indices, indices + 3*face_count),
+      face_alive_(face_count, true), vertex_faces_(vertex_count), quadrics_(vertex_count),
+      version_(vertex_count, 0), vertex_alive_(vertex_count, true), live_faces_(face_count) {
+    // Edge -> how many faces use it, to find open boundaries
+    std::vector<uint64_t> keys;
+    keys.reserve(3*face_count);
+    for (std::size_t f = 0; f < face_count; f++) {
+      const uint32_t *t = &faces_[3*f];
+      if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2]) {
+        face_alive_[f] = false;
+        live_faces_--;
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        vertex_faces_[t[k]].push_back(f);
+        uint64_t a = t[k], b = t[(k+1) % 3];
+        keys.push_back(std::min(a, b) << 32 | std::max(a, b));
+      }
+
+      double n[3];
+      normal(&pos_[3*t[0]], &pos_[3*t[1]], &pos_[3*t[2]], n);
+      double len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+      if (len == 0) {
+        continue;
+      }
+      for (double& c: n) {
+        c /= len;
+      }
+      double d = -(n[0]*pos_[3*t[0]] + n[1]*pos_[3*t[0]+1] + n[2]*pos_[3*t[0]+2]);
+      for (int k = 0; k < 3; k++) {
+        quadrics_[t[k]].add_plane(n[0], n[1], n[2], d, 1);
+      }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // Boundary edges get a stiff plane through them, perpendicular to their face
+    for (std::size_t f = 0; f < face_count; f++) {
+      if (!face_alive_[f]) {
+        continue;
+      }
+      const uint32_t *t = &faces_[3*f];
+      double n[3];
+      normal(&pos_[3*t[0]], &pos_[3*t[1]], &pos_[3*t[2]], n);
+      for (int k = 0; k < 3; k++) {
+        uint64_t a = t[k], b = t[(k+1) % 3];
+        uint64_t key = std::min(a, b) << 32 | std::max(a, b);
+        auto range = std::equal_range(keys.begin(), keys.end(), key);
+        if (range.second - range.first != 1) {
+          continue;
+        }
+        const double *p = &pos_[3*a], *q = &pos_[3*b];
+        double e[3] = {q[0] - p[0], q[1] - p[1], q[2] - p[2]};
+        double m[3] = {e[1]*n[2] - e[2]*n[1], e[2]*n[0] - e[0]*n[2], e[0]*n[1] - e[1]*n[0]};
+        double len = sqrt(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+        if (len == 0) {
+          continue;
+        }
+        for (double& c: m) {
+          c /= len;
+        }
+        double d = -(m[0]*p[0] + m[1]*p[1] + m[2]*p[2]);
+        quadrics_[a].add_plane(m[0], m[1], m[2], d, 1000);
+        quadrics_[b].add_plane(m[0], m[1], m[2], d, 1000);
+      }
+    }
+
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (uint64_t key: keys) {
+      push_edge(key >> 32, key & 0xffffffff);
+    }
+  }
+
+  void Simplifier::push_edge(uint32_t a, uint32_t b) {
+    Quadric q = quadrics_[a];
+    q += quadrics_[b];
+    Collapse c;
+    c.keep = a;
+    c.drop = b;
+    c.keep_version = version_[a];
+    c.drop_version = version_[b];
+    if (q.minimum(c.target)) {
+      c.cost = q.error(c.target);
+    } else {
+      // Flat or straight, so any point along the edge will do; pick the best of three
+      const double *pa = &pos_[3*a], *pb = &pos_[3*b];
+      double mid[3] = {(pa[0] + pb[0]) / 2, (pa[1] + pb[1]) / 2, (pa[2] + pb[2]) / 2};
+      const double *options[] = {pa, pb, mid};
+      c.cost = 1e300;
+      for (auto o: options) {
+        double e = q.error(o);
+        if (e < c.cost) {
+          c.cost = e;
+          std::copy(o, o + 3, c.target);
+        }
+      }
+    }
+    heap_.push(c);
+  }
+
+  // Would moving `moved` to p turn any of its faces (other than those shared
+  // with `other`, which disappear) upside down?
+  bool Simplifier::flips(uint32_t moved, uint32_t other, const double p[3]) const {
+    for (uint32_t f: vertex_faces_[moved]) {
+      if (!face_alive_[f]) {
+        continue;
+      }
+      const uint32_t *t = &faces_[3*f];
+      if (t[0] == other || t[1] == other || t[2] == other) {
+        continue;
+      }
+      const double *corners[3], *moved_corners[3];
+      for (int k = 0; k < 3; k++) {
+        corners[k] = &pos_[3*t[k]];
+        moved_corners[k] = t[k] == moved ? p : corners[k];
+      }
+      double before[3], after[3];
+      normal(corners[0], corners[1], corners[2], before);
+      normal(moved_corners[0], moved_corners[1], moved_corners[2], after);
+      if (before[0]*after[0] + before[1]*after[1] + before[2]*after[2] <= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Simplifier::collapse(const Collapse& c) {
+    uint32_t keep = c.keep, drop = c.drop;
+    for (uint32_t f: vertex_faces_[drop]) {
+      if (!face_alive_[f]) {
+        continue;
+      }
+      uint32_t *t = &faces_[3*f];
+      if (t[0] == keep || t[1] == keep || t[2] == keep) {
+        face_alive_[f] = false;
+        live_faces_--;
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        if (t[k] == drop) {
+          t[k] = keep;
+        }
+      }
+      vertex_faces_[keep].push_back(f);
+    }
+    vertex_faces_[drop] = std::vector<uint32_t>();
+    vertex_alive_[drop] = false;
+    quadrics_[keep] += quadrics_[drop];
+    std::copy(c.target, c.target + 3, &pos_[3*keep]);
+    version_[keep]++;
+    max_cost_ = std::max(max_cost_, c.cost);
+
+    auto& around = vertex_faces_[keep];
+    around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t f) { return !face_alive_[f]; }),
+                 around.end());
+    std::vector<uint32_t> neighbours;
+    for (uint32_t f: around) {
+      for (int k = 0; k < 3; k++) {
+        if (faces_[3*f + k] != keep) {
+          neighbours.push_back(faces_[3*f + k]);
+        }
+      }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    for (uint32_t n: neighbours) {
+      push_edge(keep, n);
+    }
+  }
+
+  SimplifiedMesh Simplifier::snapshot() const {
+    SimplifiedMesh mesh;
+    std::vector<uint32_t> remap(vertex_alive_.size(), UINT32_MAX);
+    for (std::size_t f = 0; f < face_alive_.size(); f++) {
+      if (!face_alive_[f]) {
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = faces_[3*f + k];
+        if (remap[v] == UINT32_MAX) {
+          remap[v] = mesh.positions.size() / 3;
+          mesh.positions.insert(mesh.positions.end(), &pos_[3*v], &pos_[3*v] + 3);
+        }
+        mesh.indices.push_back(remap[v]);
+      }
+    }
+    mesh.error = sqrt(std::max(0.0, max_cost_));
+    return mesh;
+  }
+
+  std::vector<SimplifiedMesh> Simplifier::run(const std::vector<std::size_t>& targets) {
+    std::vector<SimplifiedMesh> levels;
+    for (std::size_t target: targets) {
+      while (live_faces_ > target && !heap_.empty()) {
+        Collapse c = heap_.top();
+        heap_.pop();
+        if (!vertex_alive_[c.keep] || !vertex_alive_[c.drop] ||
+            version_[c.keep] != c.keep_version || version_[c.drop] != c.drop_version) {
+          continue;
+        }
+        if (flips(c.keep, c.drop, c.target) || flips(c.drop, c.keep, c.target)) {
+          continue;
+        }
+        collapse(c);
+      }
+      if (live_faces_ > target) {
+        break;
+      }
+      levels.push_back(snapshot());
+    }
+    return levels;
+  }
+}
+
+std::vector<SimplifiedMesh> simplify(const float *positions, std::size_t vertex_count,
+                                     const uint32_t *indices, std::size_t face_count,
+                                     const std::vector<std::size_t>& targets) {
+  return Simplifier(positions, vertex_count, indices, face_count).run(targets);
+}
@@ -0,0 +1,23 @@
+#ifndef SIMPLIFY_H_
+#define SIMPLIFY_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct SimplifiedMesh {
+  std::vector<float> positions; // x y z
+  std::vector<uint32_t> indices;
+  float error; // rough distance from the original, in model units
+};
+
+// Edge collapse with quadric error metrics (Garland and Heckbert 1997).
+// Collapses cheapest edges first and takes a snapshot each time the face
+// count drops to the next of `targets`, which must be decreasing. Open
+// boundaries are held in place by extra planes, collapses that would flip a
+// face are skipped. Stops early if nothing more can be collapsed.
+std::vector<SimplifiedMesh> simplify(const float *positions, std::size_t vertex_count,
+                                     const uint32_t *indices, std::size_t face_count,
+                                     const std::vector<std::size_t>& targets);
+
+#endif
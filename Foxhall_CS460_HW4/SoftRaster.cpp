@@ -0,0 +1,87 @@
+#include "SoftRaster.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <math.h>
+
+namespace {
+  const float kNearW = 1e-3f;
+}
+
+SoftRaster::SoftRaster(int width, int height)
+  : width_{width}, height_{height}, pixels_(static_cast<std::size_t>(width) * height, 0) {}
+
+void SoftRaster::clear() {
+  std::fill(pixels_.begin(), pixels_.end(), 0);
+  lit_ = 0;
+}
+
+void SoftRaster::draw_edges(const ClipVertices& v, const uint32_t* edges, std::size_t edge_count) {
+  float half_w = width_ / 2.0f, half_h = height_ / 2.0f;
+  for (std::size_t e = 0; e < edge_count; e++) {
+    uint32_t a = edges[2*e], b = edges[2*e + 1];
+    float ax = v.x[a], ay = v.y[a], aw = v.w[a];
+    float bx = v.x[b], by = v.y[b], bw = v.w[b];
+    if (aw < kNearW && bw < kNearW) {
+      continue;
+    }
+    // Cut at w = kNearW before dividing
+    if (aw < kNearW || bw < kNearW) {
+      float t = (kNearW - aw) / (bw - aw);
+      float cx = ax + t*(bx - ax), cy = ay + t*(by - ay);
+      if (aw < kNearW) {
+        ax = cx; ay = cy; aw = kNearW;
+      } else {
+        bx = cx; by = cy; bw = kNearW;
+      }
+    }
+    line((ax/aw + 1) * half_w, (1 - ay/aw) * half_h, (bx/bw + 1) * half_w, (1 - by/bw) * half_h);
+  }
+}
+
+void SoftRaster::line(float x0, float y0, float x1, float y1) {
+  // Liang-Barsky against the pixel centers' box
+  float t0 = 0, t1 = 1;
+  float dx = x1 - x0, dy = y1 - y0;
+  float p[] = {-dx, dx, -dy, dy};
+  float q[] = {x0, width_ - 1 - x0, y0, height_ - 1 - y0};
+  for (int i = 0; i < 4; i++) {
+    if (p[i] == 0) {
+      if (q[i] < 0) {
+        return;
+      }
+      continue;
+    }
+    float r = q[i] / p[i];
+    if (p[i] < 0) {
+      t0 = std::max(t0, r);
+    } else {
+      t1 = std::min(t1, r);
+    }
+  }
+  if (t0 > t1) {
+    return;
+  }
+
+  // DDA along the major axis
+  float sx = x0 + t0*dx, sy = y0 + t0*dy;
+  float ex = x0 + t1*dx, ey = y0 + t1*dy;
+  int steps = static_cast<int>(std::max(fabsf(ex - sx), fabsf(ey - sy)));
+  float ix = steps ? (ex - sx) / steps : 0, iy = steps ? (ey - sy) / steps : 0;
+  float x = sx + 0.5f, y = sy + 0.5f;
+  for (int i = 0; i <= steps; i++, x += ix, y += iy) {
+    int px = std::min(width_ - 1, static_cast<int>(x)), py = std::min(height_ - 1, static_cast<int>(y));
+    pixels_[static_cast<std::size_t>(py) * width_ + px] = 255;
+  }
+  lit_ += steps + 1;
+}
+
+void SoftRaster::write_pgm(const std::string& filename) const {
+  std::ofstream out(filename, std::ios::binary);
+  out << "P5\n" << width_ << " " << height_ << "\n255\n";
+  out.write(reinterpret_cast<const char*>(pixels_.data()), pixels_.size());
+  if (!out) {
+    throw std::runtime_error("Could not write " + filename);
+  }
+}
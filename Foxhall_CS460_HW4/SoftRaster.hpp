@@ -0,0 +1,34 @@
+#ifndef SOFT_RASTER_H_
+#define SOFT_RASTER_H_
+
+#include "VertexTransform.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 8-bit grayscale framebuffer that draws wireframes without GL, for
+// headless runs and benchmarks
+class SoftRaster {
+  public:
+    SoftRaster(int width, int height);
+    void clear();
+    // Edges between clip space vertices, cut at the near plane and the
+    // screen edges
+    void draw_edges(const ClipVertices& v, const uint32_t* edges, std::size_t edge_count);
+    // Screen space, y down
+    void line(float x0, float y0, float x1, float y1);
+    void write_pgm(const std::string& filename) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const std::vector<uint8_t>& pixels() const { return pixels_; }
+    // Pixels written since clear()
+    std::size_t lit() const { return lit_; }
+  private:
+    int width_, height_;
+    std::vector<uint8_t> pixels_;
+    std::size_t lit_ = 0;
+};
+
+#endif
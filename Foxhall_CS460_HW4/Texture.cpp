@@ -1,9 +1,19 @@
 #include "Texture.hpp"
+#include "MappedFile.hpp"
 
-#include <OpenGL/gl.h>
-
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 // Triangle
 bool Triangle::contains_vert(const Vertex& v) {
@@ -14,13 +24,13 @@ bool Triangle::contains_vert(const Vertex& v) {
   return 0 <= a && a <= 1 && 0 <= b && b <= 1 && 0 <= c && c <= 1;
 }
 
-inline BaryVertex Triangle::get_coords(const Vertex& v) {
+BaryVertex Triangle::get_coords(const Vertex& v) {
   double a = ((v2.second-v3.second)*(v.first-v3.first)+(v3.first-v2.first)*(v.second-v3.second))/((v2.second-v3.second)*(v1.first-v3.first)+(v3.first-v2.first)*(v1.second-v3.second));
   double b = ((v3.second-v1.second)*(v.first-v3.first)+(v1.first-v3.first)*(v.second-v3.second))/((v2.second-v3.second)*(v1.first-v3.first)+(v3.first-v2.first)*(v1.second-v3.second));
   return BaryVertex(a, b, 1-a-b);
 }
 
-inline Vertex Triangle::barycentric_to_cart(const BaryVertex& bv) {
+Vertex Triangle::barycentric_to_cart(const BaryVertex& bv) {
   auto a = std::get<0>(bv);
   auto b = std::get<1>(bv);
   auto c = std::get<2>(bv);
@@ -29,25 +39,424 @@ inline Vertex Triangle::barycentric_to_cart(const BaryVertex& bv) {
   return Vertex(x, y);
 }
 
-void Triangle::insert(const Vertex& v, const Color& c) {
-  auto barys = this->get_coords(v);
-  texture_.insert(std::make_pair(barys, c));
+namespace {
+  inline int clamp(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+  }
+
+  inline void sample(const Bitmap& src, double u, double v, Filter filter, unsigned char *out) {
+    if (filter == FILTER_NEAREST) {
+      int x = clamp(static_cast<int>(floor(u + 0.5)), 0, src.width - 1);
+      int y = clamp(static_cast<int>(floor(v + 0.5)), 0, src.height - 1);
+      const unsigned char *p = &src.data[3*(y*src.width + x)];
+      out[0] = p[0];
+      out[1] = p[1];
+      out[2] = p[2];
+      return;
+    }
+    double fu = floor(u), fv = floor(v);
+    double tx = u - fu, ty = v - fv;
+    int x0 = clamp(static_cast<int>(fu), 0, src.width - 1), x1 = clamp(static_cast<int>(fu) + 1, 0, src.width - 1);
+    int y0 = clamp(static_cast<int>(fv), 0, src.height - 1), y1 = clamp(static_cast<int>(fv) + 1, 0, src.height - 1);
+    const unsigned char *p00 = &src.data[3*(y0*src.width + x0)], *p10 = &src.data[3*(y0*src.width + x1)];
+    const unsigned char *p01 = &src.data[3*(y1*src.width + x0)], *p11 = &src.data[3*(y1*src.width + x1)];
+    for (int c = 0; c < 3; c++) {
+      double bottom = p00[c] + tx*(p10[c] - p00[c]);
+      double top = p01[c] + tx*(p11[c] - p01[c]);
+      out[c] = static_cast<unsigned char>(bottom + ty*(top - bottom) + 0.5);
+    }
+  }
+
+  // One triangle's warp, with the weights of v1 and v2 as planes
+  // a0 + da_dx*x + da_dy*y over destination pixels
+  struct WarpSetup {
+    const Bitmap *src;
+    Bitmap *dst;
+    Filter filter;
+    int min_x, max_x, min_y, max_y;
+    double a0, da_dx, da_dy;
+    double b0, db_dx, db_dy;
+    double s[6]; // s1 s2 s3 as x y pairs
+  };
+
+  typedef void (*WarpRowsFn)(const WarpSetup&, int, int);
+
+  // Weights down to this count as inside, so a pixel on a shared edge lands
+  // in both triangles rather than neither
+  const double kInside = -1e-7;
+
+  // Narrows [lo, hi] to where value + slope*x >= kInside
+  inline void clip_span(double value, double slope, double& lo, double& hi) {
+    if (slope > 0) {
+      lo = std::max(lo, (kInside - value) / slope);
+    } else if (slope < 0) {
+      hi = std::min(hi, (kInside - value) / slope);
+    } else if (value < kInside) {
+      hi = lo - 1;
+    }
+  }
+
+  // The pixels [x0, x1] of row y inside the triangle, solved from the three
+  // edge equations so nothing outside is visited. False if there are none.
+  inline bool row_span(const WarpSetup& w, int y, int& x0, int& x1) {
+    double a = w.a0 + w.da_dy*y, b = w.b0 + w.db_dy*y;
+    double lo = w.min_x, hi = w.max_x;
+    clip_span(a, w.da_dx, lo, hi);
+    clip_span(b, w.db_dx, lo, hi);
+    clip_span(1 - a - b, -w.da_dx - w.db_dx, lo, hi);
+    if (lo > hi) {
+      return false;
+    }
+    x0 = static_cast<int>(ceil(lo));
+    x1 = static_cast<int>(floor(hi));
+    return x0 <= x1;
+  }
+
+  // Rows [y0, y1). Each weight and the source position are linear in x, so
+  // they're stepped rather than recomputed.
+  void warp_rows_scalar(const WarpSetup& w, int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      int x0, x1;
+      if (!row_span(w, y, x0, x1)) {
+        continue;
+      }
+      double a = w.a0 + w.da_dx*x0 + w.da_dy*y;
+      double b = w.b0 + w.db_dx*x0 + w.db_dy*y;
+      unsigned char *out = &w.dst->data[3*(y*w.dst->width + x0)];
+      for (int x = x0; x <= x1; x++, a += w.da_dx, b += w.db_dx, out += 3) {
+        double c = 1 - a - b;
+        double u = a*w.s[0] + b*w.s[2] + c*w.s[4];
+        double v = a*w.s[1] + b*w.s[3] + c*w.s[5];
+        sample(*w.src, u, v, w.filter, out);
+      }
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2,fma")))
+  inline __m256i clamp8(__m256i i, __m256i hi) {
+    return _mm256_min_epi32(_mm256_max_epi32(i, _mm256_setzero_si256()), hi);
+  }
+
+  // Byte offset of texel (x, y)
+  __attribute__((target("avx2,fma")))
+  inline __m256i offset8(__m256i x, __m256i y, __m256i stride) {
+    __m256i i = _mm256_add_epi32(_mm256_mullo_epi32(y, stride), x);
+    return _mm256_add_epi32(i, _mm256_add_epi32(i, i));
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline __m256i gather8(const int *texels, __m256i offsets, __m256i mask) {
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), texels, offsets, mask, 1);
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline __m256 channel8(__m256i texel, int shift) {
+    return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(texel, _mm_cvtsi32_si128(shift)),
+                                               _mm256_set1_epi32(0xff)));
+  }
+
+  // Eight pixels at a time. Texels are fetched with 32-bit gathers at 3 byte
+  // strides (Bitmap keeps a spare byte at the end for the last one) and
+  // come back as BGR in the low three bytes of each lane.
+  __attribute__((target("avx2,fma")))
+  void warp_rows_avx2(const WarpSetup& w, int y0, int y1) {
+    const Bitmap& src = *w.src;
+    const int *texels = reinterpret_cast<const int *>(src.data.get());
+    const __m256 da = _mm256_set1_ps(w.da_dx), db = _mm256_set1_ps(w.db_dx);
+    const __m256 one = _mm256_set1_ps(1), half = _mm256_set1_ps(0.5f);
+    __m256 s[6];
+    for (int k = 0; k < 6; k++) {
+      s[k] = _mm256_set1_ps(w.s[k]);
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max_u = _mm256_set1_epi32(src.width - 1), max_v = _mm256_set1_epi32(src.height - 1);
+    const __m256i stride = _mm256_set1_epi32(src.width);
+    // Lanes to packed BGR, 12 bytes per 128-bit half
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    for (int y = y0; y < y1; y++) {
+      int x0, x1;
+      if (!row_span(w, y, x0, x1)) {
+        continue;
+      }
+      __m256 a_row = _mm256_set1_ps(w.a0 + w.da_dx*x0 + w.da_dy*y);
+      __m256 b_row = _mm256_set1_ps(w.b0 + w.db_dx*x0 + w.db_dy*y);
+      __m256i count = _mm256_set1_epi32(x1 - x0 + 1);
+      unsigned char *row = &w.dst->data[3*(y*w.dst->width)];
+      // Only the span's last block can be partial
+      for (int x = x0; x <= x1; x += 8) {
+        __m256i ki = _mm256_add_epi32(_mm256_set1_epi32(x - x0), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i live = _mm256_cmpgt_epi32(count, ki);
+        int mask = x1 - x >= 7 ? 0xff : (1 << (x1 - x + 1)) - 1;
+        __m256 k = _mm256_cvtepi32_ps(ki);
+        __m256 a = _mm256_fmadd_ps(da, k, a_row), b = _mm256_fmadd_ps(db, k, b_row);
+        __m256 c = _mm256_sub_ps(_mm256_sub_ps(one, a), b);
+        __m256 u = _mm256_fmadd_ps(a, s[0], _mm256_fmadd_ps(b, s[2], _mm256_mul_ps(c, s[4])));
+        __m256 v = _mm256_fmadd_ps(a, s[1], _mm256_fmadd_ps(b, s[3], _mm256_mul_ps(c, s[5])));
+
+        __m256i texel;
+        if (w.filter == FILTER_NEAREST) {
+          __m256i iu = clamp8(_mm256_cvtps_epi32(_mm256_floor_ps(_mm256_add_ps(u, half))), max_u);
+          __m256i iv = clamp8(_mm256_cvtps_epi32(_mm256_floor_ps(_mm256_add_ps(v, half))), max_v);
+          texel = gather8(texels, offset8(iu, iv, stride), live);
+        } else {
+          __m256 fu = _mm256_floor_ps(u), fv = _mm256_floor_ps(v);
+          __m256 tx = _mm256_sub_ps(u, fu), ty = _mm256_sub_ps(v, fv);
+          __m256i iu = _mm256_cvtps_epi32(fu), iv = _mm256_cvtps_epi32(fv);
+          __m256i u0 = clamp8(iu, max_u), u1 = clamp8(_mm256_add_epi32(iu, _mm256_set1_epi32(1)), max_u);
+          __m256i v0 = clamp8(iv, max_v), v1 = clamp8(_mm256_add_epi32(iv, _mm256_set1_epi32(1)), max_v);
+          __m256i t00 = gather8(texels, offset8(u0, v0, stride), live);
+          __m256i t10 = gather8(texels, offset8(u1, v0, stride), live);
+          __m256i t01 = gather8(texels, offset8(u0, v1, stride), live);
+          __m256i t11 = gather8(texels, offset8(u1, v1, stride), live);
+          texel = zero;
+          for (int shift = 0; shift < 24; shift += 8) {
+            __m256 p00 = channel8(t00, shift), p10 = channel8(t10, shift);
+            __m256 p01 = channel8(t01, shift), p11 = channel8(t11, shift);
+            __m256 bottom = _mm256_fmadd_ps(tx, _mm256_sub_ps(p10, p00), p00);
+            __m256 top = _mm256_fmadd_ps(tx, _mm256_sub_ps(p11, p01), p01);
+            __m256 value = _mm256_add_ps(_mm256_fmadd_ps(ty, _mm256_sub_ps(top, bottom), bottom), half);
+            texel = _mm256_or_si256(texel, _mm256_slli_epi32(_mm256_cvttps_epi32(value), shift));
+          }
+        }
+
+        unsigned char *out = row + 3*x;
+        if (mask == 0xff) {
+          alignas(32) unsigned char packed[32];
+          _mm256_store_si256(reinterpret_cast<__m256i *>(packed), _mm256_shuffle_epi8(texel, pack));
+          std::memcpy(out, packed, 12);
+          std::memcpy(out + 12, packed + 16, 12);
+        } else {
+          alignas(32) int lanes[8];
+          _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), texel);
+          for (; mask; mask &= mask - 1) {
+            int i = __builtin_ctz(mask);
+            std::memcpy(out + 3*i, &lanes[i], 3);
+          }
+        }
+      }
+    }
+  }
+#endif
+
+  typedef void (*HalveRowFn)(const unsigned char *, const unsigned char *, unsigned char *, int, int);
+
+  // Output texels [x, width) of a mip row from the two source rows under it
+  void halve_row_scalar(const unsigned char *r0, const unsigned char *r1, unsigned char *out, int x, int width) {
+    for (; x < width; x++) {
+      for (int c = 0; c < 3; c++) {
+        out[3*x + c] = (r0[6*x + c] + r0[6*x + 3 + c] + r1[6*x + c] + r1[6*x + 3 + c] + 2) >> 2;
+      }
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  // Byte shuffles splitting 16 texels (three 16 byte loads) into the even
+  // ones and the odd ones, 24 bytes each as a low 16 and high 8:
+  // masks[even lo, even hi, odd lo, odd hi][load]
+  struct HalveMasks {
+    alignas(16) signed char m[4][3][16];
+  };
+
+  const HalveMasks& halve_masks() {
+    static const HalveMasks masks = [] {
+      HalveMasks h;
+      for (int out = 0; out < 4; out++) {
+        for (int load = 0; load < 3; load++) {
+          for (int i = 0; i < 16; i++) {
+            int j = (out % 2)*16 + i;
+            int from = 6*(j/3) + j%3 + (out / 2)*3 - 16*load;
+            h.m[out][load][i] = j < 24 && from >= 0 && from < 16 ? from : -1;
+          }
+        }
+      }
+      return h;
+    }();
+    return masks;
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline __m256i pick16(const __m128i src[3], const signed char m[3][16]) {
+    __m128i picked = _mm_or_si128(
+      _mm_or_si128(_mm_shuffle_epi8(src[0], _mm_load_si128(reinterpret_cast<const __m128i *>(m[0]))),
+                   _mm_shuffle_epi8(src[1], _mm_load_si128(reinterpret_cast<const __m128i *>(m[1])))),
+      _mm_shuffle_epi8(src[2], _mm_load_si128(reinterpret_cast<const __m128i *>(m[2]))));
+    return _mm256_cvtepu8_epi16(picked);
+  }
+
+  // Eight output texels per step, summed in 16 bits
+  __attribute__((target("avx2,fma")))
+  void halve_row_avx2(const unsigned char *r0, const unsigned char *r1, unsigned char *out, int x, int width) {
+    const HalveMasks& h = halve_masks();
+    const __m256i two = _mm256_set1_epi16(2);
+    for (; x + 8 <= width; x += 8) {
+      __m256i lo = two, hi = two;
+      const unsigned char *rows[] = {r0 + 6*x, r1 + 6*x};
+      for (auto r: rows) {
+        __m128i src[3];
+        for (int k = 0; k < 3; k++) {
+          src[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + 16*k));
+        }
+        lo = _mm256_add_epi16(lo, _mm256_add_epi16(pick16(src, h.m[0]), pick16(src, h.m[2])));
+        hi = _mm256_add_epi16(hi, _mm256_add_epi16(pick16(src, h.m[1]), pick16(src, h.m[3])));
+      }
+      lo = _mm256_srli_epi16(lo, 2);
+      hi = _mm256_srli_epi16(hi, 2);
+      __m128i packed_lo = _mm_packus_epi16(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+      __m128i packed_hi = _mm_packus_epi16(_mm256_castsi256_si128(hi), _mm256_castsi256_si128(hi));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3*x), packed_lo);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 3*x + 16), packed_hi);
+    }
+    halve_row_scalar(r0, r1, out, x, width);
+  }
+#endif
+
+  struct Isa {
+    WarpRowsFn fn;
+    HalveRowFn halve;
+    const char *name;
+  };
+
+  const Isa& best_isa() {
+    static const Isa isa = [] {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa{warp_rows_avx2, halve_row_avx2, "avx2"};
+      }
+#endif
+      return Isa{warp_rows_scalar, halve_row_scalar, "scalar"};
+    }();
+    return isa;
+  }
+}
+
+namespace {
+  // False if the triangle is degenerate or misses dst
+  bool make_setup(const Vertex v[3], const Vertex s[3], const MipChain& levels, Bitmap& dst, Filter filter,
+                  double scale, Vertex origin, WarpSetup& w) {
+    double x1 = v[0].first*scale - origin.first, y1 = v[0].second*scale - origin.second;
+    double x2 = v[1].first*scale - origin.first, y2 = v[1].second*scale - origin.second;
+    double x3 = v[2].first*scale - origin.first, y3 = v[2].second*scale - origin.second;
+    double area = (x2 - x1)*(y3 - y1) - (x3 - x1)*(y2 - y1);
+    if (levels.empty() || !levels[0] || area == 0) {
+      return false;
+    }
+    double inv = 1 / area;
+
+    // Each destination pixel covers 1/scale texels, so read the level where
+    // that's closest to one without going under
+    int level = 0;
+    if (scale < 1) {
+      level = std::min(static_cast<int>(levels.size()) - 1, static_cast<int>(floor(log2(1 / scale))));
+    }
+    double shrink = 1 << level;
+
+    w.src = levels[level].get();
+    w.dst = &dst;
+    w.filter = filter;
+    w.min_x = std::max(0, static_cast<int>(floor(std::min({x1, x2, x3}))));
+    w.max_x = std::min(dst.width - 1, static_cast<int>(ceil(std::max({x1, x2, x3}))));
+    w.min_y = std::max(0, static_cast<int>(floor(std::min({y1, y2, y3}))));
+    w.max_y = std::min(dst.height - 1, static_cast<int>(ceil(std::max({y1, y2, y3}))));
+    if (w.min_x > w.max_x || w.min_y > w.max_y) {
+      return false;
+    }
+    // a = ((x2 - x)(y3 - y) - (x3 - x)(y2 - y)) / area, b likewise from v3 and v1
+    w.a0 = (x2*y3 - x3*y2) * inv;
+    w.da_dx = (y2 - y3) * inv;
+    w.da_dy = (x3 - x2) * inv;
+    w.b0 = (x3*y1 - x1*y3) * inv;
+    w.db_dx = (y3 - y1) * inv;
+    w.db_dy = (x1 - x3) * inv;
+    // Texel centers are at integer coordinates on every level
+    for (int k = 0; k < 3; k++) {
+      w.s[2*k] = (s[k].first + 0.5) / shrink - 0.5;
+      w.s[2*k + 1] = (s[k].second + 0.5) / shrink - 0.5;
+    }
+    return true;
+  }
+}
+
+void Triangle::warp(Bitmap& dst, Filter filter, double scale, bool simd, Vertex origin) const {
+  Vertex v[] = {v1, v2, v3}, s[] = {s1_, s2_, s3_};
+  WarpSetup w;
+  if (!make_setup(v, s, levels_, dst, filter, scale, origin, w)) {
+    return;
+  }
+  WarpRowsFn fn = simd ? best_isa().fn : warp_rows_scalar;
+  fn(w, w.min_y, w.max_y + 1);
+}
+
+void warp_triangles(const Triangle *tris, std::size_t count, Bitmap& dst, Filter filter, double scale,
+                    unsigned threads, Vertex origin) {
+  std::vector<WarpSetup> setups(count);
+  std::size_t n = 0;
+  int min_y = dst.height, max_y = -1;
+  long pixels = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    const Triangle& t = tris[i];
+    Vertex v[] = {t.v1, t.v2, t.v3}, s[] = {t.s1_, t.s2_, t.s3_};
+    WarpSetup& w = setups[n];
+    if (make_setup(v, s, t.levels_, dst, filter, scale, origin, w)) {
+      min_y = std::min(min_y, w.min_y);
+      max_y = std::max(max_y, w.max_y);
+      pixels += static_cast<long>(w.max_x - w.min_x + 1) * (w.max_y - w.min_y + 1);
+      n++;
+    }
+  }
+  if (n == 0) {
+    return;
+  }
+
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Not worth a thread for less than 64k pixels
+  int bands = static_cast<int>(std::max<long>(1, std::min<long>(std::min<long>(threads, pixels >> 16), max_y - min_y + 1)));
+  WarpRowsFn fn = best_isa().fn;
+  auto run = [&](int band) {
+    int y0 = min_y + (max_y - min_y + 1) * band / bands;
+    int y1 = min_y + (max_y - min_y + 1) * (band + 1) / bands;
+    for (std::size_t i = 0; i < n; i++) {
+      int from = std::max(y0, setups[i].min_y), to = std::min(y1, setups[i].max_y + 1);
+      if (from < to) {
+        fn(setups[i], from, to);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int band = 1; band < bands; band++) {
+    workers.emplace_back(run, band);
+  }
+  run(0);
+  for (auto& w: workers) {
+    w.join();
+  }
 }
 
-void Triangle::draw() {
-  glBegin(GL_POINTS);
-  for (auto it: texture_) {
-    auto r = std::get<0>(it.second);
-    auto g = std::get<1>(it.second);
-    auto b = std::get<2>(it.second);
-    auto cart = this->barycentric_to_cart(it.first);
-    glColor3ub(r, g, b);
-    glVertex2d(cart.first, cart.second);
-    glVertex2d(cart.first+1, cart.second+1);
-    glVertex2d(cart.first+2, cart.second+2);
-    glVertex2d(cart.first+3, cart.second+3);
-  }
-  glEnd();
+WarpBounds warp_bounds(const Triangle *tris, std::size_t count, double scale) {
+  double lo[] = {INFINITY, INFINITY}, hi[] = {-INFINITY, -INFINITY};
+  for (std::size_t i = 0; i < count; i++) {
+    for (const Vertex& v: {tris[i].v1, tris[i].v2, tris[i].v3}) {
+      lo[0] = std::min(lo[0], v.first*scale);
+      lo[1] = std::min(lo[1], v.second*scale);
+      hi[0] = std::max(hi[0], v.first*scale);
+      hi[1] = std::max(hi[1], v.second*scale);
+    }
+  }
+  if (count == 0) {
+    return WarpBounds{0, 0, 1, 1};
+  }
+  // Same rounding as make_setup, which fills out to ceil of the max
+  int x = static_cast<int>(floor(lo[0])), y = static_cast<int>(floor(lo[1]));
+  return WarpBounds{x, y, static_cast<int>(ceil(hi[0])) - x + 1, static_cast<int>(ceil(hi[1])) - y + 1};
+}
+
+const char* warp_isa() {
+  return best_isa().name;
 }
 
 std::ostream& operator<<(std::ostream& os, Vertex bv) {
@@ -58,21 +467,91 @@ std::ostream& operator<<(std::ostream& os, const Triangle& t) {
   return os << "Triangle (" << t.v1 << "; " << t.v2 << "; " << t.v3 << ")";
 }
 
+namespace {
+  inline uint32_t read_u32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+  }
+
+  inline uint16_t read_u16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+  }
+}
+
 // Bitmap loading utility
 Bitmap load_bmp(const char *filename) {
-  // Load bmp file, BGR
-  std::ifstream file(filename, std::ios::binary | std::ios::in);
-  int width, height;
-  // Header ends at 54, height at 18 and width at 22
-  file.seekg(18);
-  file.read((char *)&width, 4);
-  file.read((char *)&height, 4);
+  MappedFile file(filename);
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(file.data());
+  std::string name(filename);
+  // File header is 14 bytes, then at least a 40 byte BITMAPINFOHEADER
+  if (file.size() < 54 || bytes[0] != 'B' || bytes[1] != 'M' || read_u32(bytes + 14) < 40) {
+    throw std::runtime_error(name + " is not a Windows BMP");
+  }
+  uint32_t offset = read_u32(bytes + 10);
+  int32_t width = read_u32(bytes + 18), height = read_u32(bytes + 22);
+  int bpp = read_u16(bytes + 28);
+  uint32_t compression = read_u32(bytes + 30);
+  // Negative height means rows are stored top to bottom
+  bool top_down = height < 0;
+  if (top_down && height > INT32_MIN) {
+    height = -height;
+  }
+  if (width <= 0 || height <= 0 || width > 1 << 16 || height > 1 << 16) {
+    throw std::runtime_error(name + ": bad size " + std::to_string(width) + "x" + std::to_string(height));
+  }
+  if (bpp != 24 && bpp != 32) {
+    throw std::runtime_error(name + ": " + std::to_string(bpp) + " bits per pixel isn't supported");
+  }
+  // 32 bit may spell out its channel masks, fine as long as they're BGRA
+  if (compression == 3 && bpp == 32) {
+    if (file.size() < 66 || read_u32(bytes + 54) != 0xff0000 || read_u32(bytes + 58) != 0xff00 ||
+        read_u32(bytes + 62) != 0xff) {
+      throw std::runtime_error(name + ": only BGRA bitfields are supported");
+    }
+  } else if (compression != 0) {
+    throw std::runtime_error(name + ": compressed BMPs aren't supported");
+  }
+  // Rows are padded to 4 bytes
+  std::size_t stride = (static_cast<std::size_t>(width)*bpp + 31) / 32 * 4;
+  if (offset > file.size() || (file.size() - offset) / stride < static_cast<std::size_t>(height)) {
+    throw std::runtime_error(name + " is truncated");
+  }
 
   Bitmap bmp{width, height};
-  file.seekg(54);
-  // Read in BGR pixels
-  file.read((char *)bmp.data.get(), 3*width*height);
-
+  for (int y = 0; y < height; y++) {
+    const unsigned char *row = bytes + offset + stride*(top_down ? height - 1 - y : y);
+    unsigned char *out = &bmp.data[3*static_cast<std::size_t>(y)*width];
+    if (bpp == 24) {
+      std::memcpy(out, row, 3*width);
+    } else {
+      for (int x = 0; x < width; x++, row += 4, out += 3) {
+        out[0] = row[0];
+        out[1] = row[1];
+        out[2] = row[2];
+      }
+    }
+  }
   return bmp;
 }
 
+MipChain build_mips(std::shared_ptr<const Bitmap> base, bool simd) {
+  MipChain levels{base};
+  HalveRowFn halve = simd ? best_isa().halve : halve_row_scalar;
+  while (levels.back()->width > 1 || levels.back()->height > 1) {
+    const Bitmap& src = *levels.back();
+    auto dst = std::make_shared<Bitmap>(std::max(1, src.width / 2), std::max(1, src.height / 2));
+    for (int y = 0; y < dst->height; y++) {
+      const unsigned char *r0 = &src.data[3*static_cast<std::size_t>(2*y)*src.width];
+      const unsigned char *r1 = src.height > 1 ? r0 + 3*src.width : r0;
+      unsigned char *out = &dst->data[3*static_cast<std::size_t>(y)*dst->width];
+      if (src.width == 1) {
+        for (int c = 0; c < 3; c++) {
+          out[c] = (r0[c] + r1[c] + 1) >> 1;
+        }
+      } else {
+        halve(r0, r1, out, 0, dst->width);
+      }
+    }
+    levels.push_back(dst);
+  }
+  return levels;
+}
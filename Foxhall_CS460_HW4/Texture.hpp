@@ -1,21 +1,35 @@
 #ifndef TEXTURE_H_
 #define TEXTURE_H_
 
-#include <map>
-#include <tuple>
+#include <cstddef>
 #include <memory>
+#include <ostream>
+#include <tuple>
+#include <vector>
 
+// Rows bottom to top, BGR. One byte past the last texel is allocated so it
+// can be read with a 4 byte load.
 struct Bitmap {
   using Data = std::unique_ptr<unsigned char[]>;
   int width, height;
   Data data;
 
   Bitmap() = default;
-  Bitmap(int w, int h): width{w}, height{h}, data{new unsigned char[3*w*h]} {}
+  Bitmap(int w, int h): width{w}, height{h}, data{new unsigned char[3*w*h + 1]} {}
 };
 
+// Uncompressed 24 and 32 bit BMPs, bottom-up or top-down, read through
+// mmap. Throws std::runtime_error on anything else or a truncated file.
 Bitmap load_bmp(const char *);
 
+// levels[0] is the bitmap itself, each one after it half the size of the
+// last (odd sizes round down) until 1x1, every texel the average of the 2x2
+// under it. AVX2 when the CPU has it and simd is true.
+using MipChain = std::vector<std::shared_ptr<const Bitmap>>;
+MipChain build_mips(std::shared_ptr<const Bitmap> base, bool simd = true);
+
+enum Filter { FILTER_NEAREST, FILTER_BILINEAR };
+
 using Vertex = std::pair<double, double>;
 using BaryVertex = std::tuple<double, double, double>;
 // RGB
@@ -24,19 +38,49 @@ class Triangle {
   public:
     friend std::ostream& operator<<(std::ostream& os, const Triangle&);
     Triangle() = default;
-    Triangle(Vertex v1, Vertex v2, Vertex v3):
-      v1{v1}, v2{v2}, v3{v3}, texture_{}
+    // Textured with the part of `source` under s1 s2 s3, which starts out
+    // where v1 v2 v3 are
+    Triangle(std::shared_ptr<const Bitmap> source, Vertex s1, Vertex s2, Vertex s3):
+      Triangle(MipChain{source}, s1, s2, s3)
+    {}
+    // Same over levels[0], but a warp that shrinks it reads the mip level
+    // closest to the destination's size instead
+    Triangle(MipChain levels, Vertex s1, Vertex s2, Vertex s3):
+      v1{s1}, v2{s2}, v3{s3}, levels_{std::move(levels)}, s1_{s1}, s2_{s2}, s3_{s3}
     {}
     bool contains_vert(const Vertex&);
     BaryVertex get_coords(const Vertex&);
     Vertex barycentric_to_cart(const BaryVertex&);
-    void insert(const Vertex&, const Color&);
-    void draw();
+    // Fills the pixels of dst inside v1 v2 v3 times `scale`, sampling the
+    // source at the same barycentric position in s1 s2 s3. dst's top left
+    // pixel sits at `origin` in scaled coordinates. Takes eight pixels at a
+    // time with AVX2 when the CPU has it and simd is true.
+    void warp(Bitmap& dst, Filter filter = FILTER_BILINEAR, double scale = 1, bool simd = true,
+              Vertex origin = Vertex(0, 0)) const;
+    friend void warp_triangles(const Triangle *, std::size_t, Bitmap&, Filter, double, unsigned, Vertex);
 
     Vertex v1, v2, v3;
-    std::map<BaryVertex, Color> texture_;
+  private:
+    MipChain levels_;
+    Vertex s1_, s2_, s3_;
 };
 
+// Triangle::warp for several triangles, with destination rows split into
+// bands across `threads` threads, 0 picks one per core. A band is warped by
+// one thread for every triangle, so shared edges never race.
+void warp_triangles(const Triangle *tris, std::size_t count, Bitmap& dst, Filter filter = FILTER_BILINEAR,
+                    double scale = 1, unsigned threads = 0, Vertex origin = Vertex(0, 0));
+
+// The pixels v1 v2 v3 times `scale` cover for all of tris: a canvas this
+// size with its origin at (x, y) holds every triangle whole
+struct WarpBounds {
+  int x, y, width, height;
+};
+WarpBounds warp_bounds(const Triangle *tris, std::size_t count, double scale);
+
+// Which path Triangle::warp takes with simd = true on this machine
+const char* warp_isa();
+
 std::ostream& operator<<(std::ostream&, Vertex);
 
 #endif
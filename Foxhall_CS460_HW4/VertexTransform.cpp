@@ -0,0 +1,111 @@
+#include "VertexTransform.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+  typedef void (*TransformFn)(const float *, const float *, const float *, std::size_t, std::size_t,
+                              const float *, float *, float *, float *, float *);
+
+  // Vertices [i, n)
+  void transform_scalar(const float *x, const float *y, const float *z, std::size_t i, std::size_t n,
+                        const float *m, float *ox, float *oy, float *oz, float *ow) {
+    for (; i < n; i++) {
+      ox[i] = m[0]*x[i] + m[4]*y[i] + m[8]*z[i] + m[12];
+      oy[i] = m[1]*x[i] + m[5]*y[i] + m[9]*z[i] + m[13];
+      oz[i] = m[2]*x[i] + m[6]*y[i] + m[10]*z[i] + m[14];
+      ow[i] = m[3]*x[i] + m[7]*y[i] + m[11]*z[i] + m[15];
+    }
+  }
+
+#ifdef HAVE_X86_SIMD
+  __attribute__((target("avx2,fma")))
+  void transform_avx2(const float *x, const float *y, const float *z, std::size_t i, std::size_t n,
+                      const float *m, float *ox, float *oy, float *oz, float *ow) {
+    __m256 c[16];
+    for (int k = 0; k < 16; k++) {
+      c[k] = _mm256_set1_ps(m[k]);
+    }
+    float *out[] = {ox, oy, oz, ow};
+    for (; i + 8 <= n; i += 8) {
+      __m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+      for (int r = 0; r < 4; r++) {
+        __m256 v = _mm256_fmadd_ps(c[r], vx, _mm256_fmadd_ps(c[4 + r], vy, _mm256_fmadd_ps(c[8 + r], vz, c[12 + r])));
+        _mm256_storeu_ps(out[r] + i, v);
+      }
+    }
+    transform_scalar(x, y, z, i, n, m, ox, oy, oz, ow);
+  }
+
+  void transform_sse(const float *x, const float *y, const float *z, std::size_t i, std::size_t n,
+                     const float *m, float *ox, float *oy, float *oz, float *ow) {
+    __m128 c[16];
+    for (int k = 0; k < 16; k++) {
+      c[k] = _mm_set1_ps(m[k]);
+    }
+    float *out[] = {ox, oy, oz, ow};
+    for (; i + 4 <= n; i += 4) {
+      __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+      for (int r = 0; r < 4; r++) {
+        __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r], vx), _mm_mul_ps(c[4 + r], vy)),
+                              _mm_add_ps(_mm_mul_ps(c[8 + r], vz), c[12 + r]));
+        _mm_storeu_ps(out[r] + i, v);
+      }
+    }
+    transform_scalar(x, y, z, i, n, m, ox, oy, oz, ow);
+  }
+#elif defined(__ARM_NEON)
+  void transform_neon(const float *x, const float *y, const float *z, std::size_t i, std::size_t n,
+                      const float *m, float *ox, float *oy, float *oz, float *ow) {
+    float *out[] = {ox, oy, oz, ow};
+    for (; i + 4 <= n; i += 4) {
+      float32x4_t vx = vld1q_f32(x + i), vy = vld1q_f32(y + i), vz = vld1q_f32(z + i);
+      for (int r = 0; r < 4; r++) {
+        float32x4_t v = vdupq_n_f32(m[12 + r]);
+        v = vmlaq_n_f32(v, vx, m[r]);
+        v = vmlaq_n_f32(v, vy, m[4 + r]);
+        v = vmlaq_n_f32(v, vz, m[8 + r]);
+        vst1q_f32(out[r] + i, v);
+      }
+    }
+    transform_scalar(x, y, z, i, n, m, ox, oy, oz, ow);
+  }
+#endif
+
+  struct Isa {
+    TransformFn fn;
+    const char *name;
+  };
+
+  const Isa& best_isa() {
+    static const Isa isa = [] {
+#ifdef HAVE_X86_SIMD
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa{transform_avx2, "avx2"};
+      }
+      return Isa{transform_sse, "sse"};
+#elif defined(__ARM_NEON)
+      return Isa{transform_neon, "neon"};
+#else
+      return Isa{transform_scalar, "scalar"};
+#endif
+    }();
+    return isa;
+  }
+}
+
+void transform_vertices(const GeoObject::Soa& in, const float m[16], ClipVertices& out, bool simd) {
+  std::size_t n = in.x.size();
+  out.resize(n);
+  TransformFn fn = simd ? best_isa().fn : transform_scalar;
+  fn(in.x.data(), in.y.data(), in.z.data(), 0, n, m, out.x.data(), out.y.data(), out.z.data(), out.w.data());
+}
+
+const char* transform_isa() {
+  return best_isa().name;
+}
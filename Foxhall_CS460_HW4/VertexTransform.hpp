@@ -0,0 +1,25 @@
+#ifndef VERTEX_TRANSFORM_H_
+#define VERTEX_TRANSFORM_H_
+
+#include "GeoObject.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Clip space positions, split by coordinate like GeoObject::Soa
+struct ClipVertices {
+  std::vector<float> x, y, z, w;
+
+  void resize(std::size_t n) { x.resize(n); y.resize(n); z.resize(n); w.resize(n); }
+  std::size_t size() const { return x.size(); }
+};
+
+// Every vertex through `m` (column-major 4x4) once. Uses AVX2+FMA when the
+// CPU has it, otherwise SSE2 or NEON, or plain C++ when simd is false or
+// there's nothing better.
+void transform_vertices(const GeoObject::Soa& in, const float m[16], ClipVertices& out, bool simd = true);
+
+// Which path simd = true takes on this machine
+const char* transform_isa();
+
+#endif
@@ -1,23 +1,64 @@
+#include "AssetManager.hpp"
+#include "Bench.hpp"
 #include "Texture.hpp"
 #include "GeoObject.hpp"
+#include "LodChain.hpp"
+#include "Bvh.hpp"
+#include "Profiler.hpp"
+#include "Replay.hpp"
 
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
 #include <GLUT/glut.h>
 
+#include <algorithm>
 #include <iostream>
 #include <assert.h>
 #include <math.h>
 #include <memory>
 #include <fstream>
+#include <stdexcept>
 #include <vector>
 
 namespace {
+  const auto startup = AssetManager::Clock::now();
+  // Never destroyed, so quitting doesn't wait for a load in progress
+  AssetManager& assets = *new AssetManager(startup);
+  bool first_frame = true;
+
+  // What the teapot scene needs, built off the GL thread
+  struct TeapotAssets {
+    LodChain lods;
+    Bvh bvh;
+  };
+  // Each scene's assets are asked for the first time it's shown
+  std::shared_future<std::shared_ptr<const MipChain>> flower_asset;
+  std::shared_future<std::shared_ptr<TeapotAssets>> teapot_asset;
+  bool flower_loaded, teapot_loaded;
+
   // Up, right, down, left
   Triangle flower_texture[4];
   int flower_height, flower_width;
+  // Where the triangles are warped to, shown as a GL texture. Scaled down
+  // to the window, so a frame costs the same whatever the bitmap's size,
+  // and sized to the triangles, which reach past the bitmap when the center
+  // is dragged outside it. The origin is in canvas pixels.
+  Bitmap flower_canvas;
+  double flower_canvas_scale;
+  WarpBounds flower_bounds;
+  GLuint flower_gl_texture;
+  bool flower_dirty;
   double rotation;
-  GeoObject teapot;
+  LodChain teapot;
+  Bvh teapot_bvh;
+  // Teapot transform from the last frame, for picking
+  GLdouble pick_modelview[16], pick_projection[16];
+  GLint pick_viewport[4];
+  Bvh::Hit picked;
+  bool is_picked = false;
+  // Set by --compact: the teapot's levels keep 16-bit positions
+  bool compact_teapot = false;
+  int wire_mode = GeoObject::WIRE_ALL;
   int scene;
   double zoom;
   Vertex center;
@@ -27,34 +68,100 @@ std::ostream& operator<<(std::ostream& os, const std::tuple<double, double, doub
   return os << std::get<0>(bv) << "," << std::get<1>(bv) << "," << std::get<2>(bv);
 }
 
-void make_flower_texture() {
-  auto flower_bmp = load_bmp("flower.bmp");
-  flower_width = flower_bmp.width;
-  flower_height = flower_bmp.height;
+std::shared_ptr<const MipChain> load_flower() {
+  auto flower_bmp = std::make_shared<Bitmap>(load_bmp("flower.bmp"));
+  return std::make_shared<MipChain>(build_mips(flower_bmp));
+}
+
+std::shared_ptr<TeapotAssets> load_teapot() {
+  GeoObject mesh("teapot.obj");
+  mesh.optimize();
+  auto out = std::make_shared<TeapotAssets>();
+  out->lods = LodChain(mesh);
+  out->bvh = Bvh(mesh);
+  if (compact_teapot) {
+    std::size_t before = 0, after = 0;
+    for (std::size_t i = 0; i < out->lods.size(); i++) {
+      before += out->lods[i].bytes();
+      out->lods[i].compress();
+      after += out->lods[i].bytes();
+    }
+    std::cout << "Compacted teapot.obj: " << out->lods.size() << " levels, " << before / 1024 << " KB -> "
+              << after / 1024 << " KB" << std::endl;
+  }
+  return out;
+}
+
+// Resizes the canvas and its texture when the triangles' bounds change size
+void fit_flower_canvas() {
+  flower_bounds = warp_bounds(flower_texture, 4, flower_canvas_scale);
+  if (flower_canvas.data && flower_canvas.width == flower_bounds.width &&
+      flower_canvas.height == flower_bounds.height) {
+    return;
+  }
+  flower_canvas = Bitmap(flower_bounds.width, flower_bounds.height);
+  glBindTexture(GL_TEXTURE_2D, flower_gl_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, flower_canvas.width, flower_canvas.height, 0, GL_BGR, GL_UNSIGNED_BYTE,
+               nullptr);
+}
+
+void make_flower_texture(const MipChain& mips) {
+  flower_width = mips[0]->width;
+  flower_height = mips[0]->height;
   auto nw = Vertex{0, 0};
-  auto ne = Vertex{flower_bmp.width, 0};
-  auto se = Vertex{flower_bmp.width, flower_bmp.height};
-  auto sw = Vertex{0, flower_bmp.height};
-  auto center = Vertex{flower_bmp.width/2, flower_bmp.height/2};
-  flower_texture[0] = Triangle{nw, ne, center};
-  flower_texture[1] = Triangle{ne, se, center};
-  flower_texture[2] = Triangle{se, sw, center};
-  flower_texture[3] = Triangle{sw, nw, center};
-
-  for (int i = 0; i < flower_bmp.width; i++) {
-    for (int j = 0; j < flower_bmp.height; j++) {
-      auto v = Vertex(i, j);
-      int offset = j*flower_bmp.width + i;
-      auto r = flower_bmp.data[3*offset+2];
-      auto g = flower_bmp.data[3*offset+1];
-      auto b = flower_bmp.data[3*offset];
-      for (int k = 0; k < 4; k++) {
-        //std::cout << flower_texture[k] << " Vertex " << v << " Barycentric coords "
-          //<< flower_texture[k].get_coords(v) << std::endl;
-        if (flower_texture[k].contains_vert(v)) {
-          flower_texture[k].insert(v, std::make_tuple(r, g, b));
-          break;
-        }
+  auto ne = Vertex{flower_width, 0};
+  auto se = Vertex{flower_width, flower_height};
+  auto sw = Vertex{0, flower_height};
+  auto center = Vertex{flower_width/2, flower_height/2};
+  // The triangles share the bitmap and its mips, each textured with the part under it
+  flower_texture[0] = Triangle{mips, nw, ne, center};
+  flower_texture[1] = Triangle{mips, ne, se, center};
+  flower_texture[2] = Triangle{mips, se, sw, center};
+  flower_texture[3] = Triangle{mips, sw, nw, center};
+  int win_w = glutGet(GLUT_WINDOW_WIDTH), win_h = glutGet(GLUT_WINDOW_HEIGHT);
+  flower_canvas_scale = std::min({1.0, static_cast<double>(win_w) / flower_width,
+                                  static_cast<double>(win_h) / flower_height});
+  fit_flower_canvas();
+  flower_dirty = true;
+}
+
+// Asks for the current scene's assets the first time it's shown and picks
+// them up once the loader is done. The scene draws nothing until then.
+// Replays wait for them instead, so events land on the same state as when
+// they were recorded.
+template <class T>
+bool take(std::shared_future<std::shared_ptr<T>>& future, std::shared_ptr<T> (*make)(), const char *name,
+          std::shared_ptr<T>& out) {
+  if (!future.valid()) {
+    future = assets.load<T>(name, make);
+  }
+  if (replay::live() && !AssetManager::ready(future)) {
+    return false;
+  }
+  try {
+    out = future.get();
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+  }
+  return true;
+}
+
+void poll_assets() {
+  if (scene == 0 && !flower_loaded) {
+    std::shared_ptr<const MipChain> mips;
+    flower_loaded = take(flower_asset, load_flower, "flower.bmp", mips);
+    if (mips) {
+      make_flower_texture(*mips);
+    }
+  } else if (scene == 1 && !teapot_loaded) {
+    std::shared_ptr<TeapotAssets> loaded;
+    teapot_loaded = take(teapot_asset, load_teapot, "teapot.obj", loaded);
+    if (loaded) {
+      teapot = std::move(loaded->lods);
+      teapot_bvh = std::move(loaded->bvh);
+      // 'b' may have been pressed while it loaded
+      for (std::size_t i = 0; i < teapot.size(); i++) {
+        teapot[i].set_wire_mode(static_cast<GeoObject::WireMode>(wire_mode));
       }
     }
   }
@@ -64,25 +171,59 @@ void init() {
   glClearColor(0.0, 0.0, 0.0, 1.0);
   //glLineWidth(2.0);
   glShadeModel(GL_FLAT);
-  make_flower_texture();
-  teapot = GeoObject("teapot.obj");
+  glGenTextures(1, &flower_gl_texture);
+  glBindTexture(GL_TEXTURE_2D, flower_gl_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   rotation = 0.0;
   scene = 0;
   zoom = 0;
 }
 
+// Re-warps the four triangles into the canvas when the center has moved,
+// then shows the canvas as one textured quad
 void draw_flower() {
+  if (!flower_canvas.data) {
+    return;
+  }
+  glBindTexture(GL_TEXTURE_2D, flower_gl_texture);
+  if (flower_dirty) {
+    PROFILE_SCOPE("flower warp");
+    fit_flower_canvas();
+    Bitmap& canvas = flower_canvas;
+    std::fill(canvas.data.get(), canvas.data.get() + 3*canvas.width*canvas.height, 0);
+    warp_triangles(flower_texture, 4, canvas, FILTER_BILINEAR, flower_canvas_scale, 0,
+                   Vertex(flower_bounds.x, flower_bounds.y));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, canvas.width, canvas.height, GL_BGR, GL_UNSIGNED_BYTE,
+                    canvas.data.get());
+    flower_dirty = false;
+  }
+
   glPushMatrix();
   glRotated(rotation, 0.0, 0.0, 1.0);
   glScalef(0.036, 0.04, 0.04);
   glTranslatef(-flower_width/2.0, -flower_height/2.0, 0.0);
-  for (int i = 0; i < 4; i++) {
-    flower_texture[i].draw();
-  }
+  // The canvas in bitmap coordinates
+  double x0 = flower_bounds.x / flower_canvas_scale, y0 = flower_bounds.y / flower_canvas_scale;
+  double x1 = (flower_bounds.x + flower_bounds.width) / flower_canvas_scale;
+  double y1 = (flower_bounds.y + flower_bounds.height) / flower_canvas_scale;
+  glEnable(GL_TEXTURE_2D);
+  glColor3f(1.0, 1.0, 1.0);
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 0); glVertex2d(x0, y0);
+  glTexCoord2f(1, 0); glVertex2d(x1, y0);
+  glTexCoord2f(1, 1); glVertex2d(x1, y1);
+  glTexCoord2f(0, 1); glVertex2d(x0, y1);
+  glEnd();
+  glDisable(GL_TEXTURE_2D);
   glPopMatrix();
 }
 
 void display() {
+  PROFILE_FRAME();
+  PROFILE_SCOPE("display");
+  poll_assets();
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // Set projection mode
@@ -105,12 +246,33 @@ void display() {
     glRotated(center.second, 1.0, 0.0, 0.0);
     glTranslatef(0.0, -5.0, 0.0);
     glScalef(3.0+zoom, 3.0+zoom, 3.0+zoom);
-    teapot.draw();
+    if (teapot.size()) {
+      // Screen pixels per model unit, 20 units away with a 60 degree fov
+      double pixels_per_unit = fabs(3.0+zoom) * glutGet(GLUT_WINDOW_HEIGHT) / (2 * 20 * tan(M_PI / 6));
+      teapot[teapot.pick(pixels_per_unit)].draw();
+    }
+    glGetDoublev(GL_MODELVIEW_MATRIX, pick_modelview);
+    glGetDoublev(GL_PROJECTION_MATRIX, pick_projection);
+    glGetIntegerv(GL_VIEWPORT, pick_viewport);
+    if (is_picked) {
+      // From the BVH, which has corners whether or not the mesh is compact
+      const float *corners = teapot_bvh.corners(picked);
+      glColor3f(1.0, 0.0, 0.0);
+      glBegin(GL_TRIANGLES);
+      for (int c = 0; c < 3; c++) {
+        glVertex3fv(corners + 3*c);
+      }
+      glEnd();
+    }
     glPopMatrix();
   }
 
   glFlush();
   glutSwapBuffers();
+  if (first_frame) {
+    std::cout << "First frame " << assets.elapsed_ms() << " ms after startup" << std::endl;
+    first_frame = false;
+  }
 }
 
 void reshape(int w, int h) {
@@ -138,6 +300,15 @@ void keyboard_handler(unsigned char key, int, int) {
       rotation = 0;
       center = Vertex(0, 0);
       break;
+    case 'b':
+      // All edges, front-facing only, silhouette only
+      if (scene == 1) {
+        wire_mode = (wire_mode + 1) % 3;
+        for (std::size_t i = 0; i < teapot.size(); i++) {
+          teapot[i].set_wire_mode(static_cast<GeoObject::WireMode>(wire_mode));
+        }
+      }
+      break;
     case 'z':
       if (scene == 1) {
         zoom += 0.05;
@@ -169,12 +340,37 @@ void mouse_motion_handler(int x, int y) {
     for (int i = 0; i < 4; i++) {
       flower_texture[i].v3 = new_center;
     }
+    flower_dirty = true;
   } else if (scene == 1) {
     center = Vertex(x-win_w/2, -y+win_h/2);
   }
 }
 
+// Highlights the teapot face under the cursor
+void mouse_pick_handler(int x, int y) {
+  if (scene != 1) {
+    return;
+  }
+  GLdouble near[3], far[3];
+  double wy = pick_viewport[3] - y;
+  if (!gluUnProject(x, wy, 0, pick_modelview, pick_projection, pick_viewport, &near[0], &near[1], &near[2]) ||
+      !gluUnProject(x, wy, 1, pick_modelview, pick_projection, pick_viewport, &far[0], &far[1], &far[2])) {
+    return;
+  }
+  float origin[3], dir[3];
+  for (int k = 0; k < 3; k++) {
+    origin[k] = near[k];
+    dir[k] = far[k] - near[k];
+  }
+  is_picked = teapot_bvh.intersect(origin, dir, picked);
+}
+
 int main(int argc, char *argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    return run_bench(argc - 2, argv + 2);
+  }
+  compact_teapot = argc > 1 && std::string(argv[1]) == "--compact";
+
   glutInit(&argc, argv);
   //Set Display Mode
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
@@ -185,12 +381,14 @@ int main(int argc, char *argv[]) {
   //Create the window
   glutCreateWindow("CS 460");
   init();
+  replay::init();
 
-  glutDisplayFunc(display);
-  glutIdleFunc(display);
+  replay::display_func(display);
+  replay::idle_func(display);
   glutReshapeFunc(reshape);
-  glutKeyboardFunc(keyboard_handler);
-  glutMotionFunc(mouse_motion_handler);
+  replay::keyboard_func(keyboard_handler);
+  replay::motion_func(mouse_motion_handler);
+  replay::passive_motion_func(mouse_pick_handler);
 
   //Enter the GLUT event loop
   glutMainLoop();
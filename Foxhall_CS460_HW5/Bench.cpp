@@ -0,0 +1,535 @@
+#include "Bench.hpp"
+#include "Patch.hpp"
+#include "PatchMesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+
+namespace {
+  // Best of a few runs, in milliseconds
+  template <class F>
+  double time_ms(F f, int runs = 3) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+      best = std::min(best, elapsed.count());
+    }
+    return best;
+  }
+
+  // How Patch used to get its 20x20 samples every frame: two pow calls per
+  // Bernstein term, 16 terms per sample (at today's parameters, edges included)
+  double bernstein_pow(int i, double u) {
+    const int binomial[] = {1, 3, 3, 1};
+    return binomial[i] * pow(u/19.0, i) * pow(1-u/19.0, 3-i);
+  }
+
+  std::vector<Patch::CPoint> samples_pow(const Patch& patch) {
+    std::vector<Patch::CPoint> pts;
+    for (int u = 0; u < 20; u++) {
+      for (int v = 0; v < 20; v++) {
+        Patch::CPoint p;
+        for (int i = 0; i < 4; i++) {
+          for (int j = 0; j < 4; j++) {
+            auto b = bernstein_pow(i, u)*bernstein_pow(j, v);
+            p.x += b*patch[j+4*i].x;
+            p.y += b*patch[j+4*i].y;
+            p.z += b*patch[j+4*i].z;
+          }
+        }
+        pts.push_back(p);
+      }
+    }
+    return pts;
+  }
+
+  // A patch that isn't flat, so nothing cancels out
+  template <class P>
+  void bend(P& patch) {
+    for (int k = 0; k < P::kRows*P::kCols; k++) {
+      patch[k].y = 10*sin(k*0.7) + 3*(k % 5);
+    }
+  }
+
+  double max_diff(const std::vector<Patch::CPoint>& a, const std::vector<Patch::CPoint>& b) {
+    double diff = 0;
+    for (std::size_t i = 0; i < a.size(); i++) {
+      diff = std::max({diff, fabs(a[i].x - b[i].x), fabs(a[i].y - b[i].y), fabs(a[i].z - b[i].z)});
+    }
+    return diff;
+  }
+
+  int eval(int argc, char *argv[]) {
+    int frames = argc > 0 ? std::atoi(argv[0]) : 1000;
+    Patch patch;
+    bend(patch);
+
+    std::vector<Patch::CPoint> reference;
+    double old_ms = time_ms([&] {
+      for (int f = 0; f < frames; f++) {
+        reference = samples_pow(patch);
+      }
+    }) / frames;
+
+    double max_error = max_diff(patch.points(), reference);
+
+    // Normals against central differences of the surface, one-sided at the edges
+    std::vector<Patch::CPoint> differenced;
+    const double h = 1e-5;
+    for (int i = 0; i < patch.rows(); i++) {
+      for (int j = 0; j < patch.cols(); j++) {
+        double u = patch.u_at(i), v = patch.v_at(j);
+        double u0 = std::max(0.0, u - h), u1 = std::min(1.0, u + h);
+        double v0 = std::max(0.0, v - h), v1 = std::min(1.0, v + h);
+        auto su = patch.evaluate(u1, v) - patch.evaluate(u0, v);
+        auto sv = patch.evaluate(u, v1) - patch.evaluate(u, v0);
+        differenced.push_back(Patch::CPoint(sv.y*su.z - sv.z*su.y, sv.z*su.x - sv.x*su.z, sv.x*su.y - sv.y*su.x).unit());
+      }
+    }
+    double normal_error = max_diff(patch.normals(), differenced);
+
+    // Touching a control point every frame forces a full re-evaluation
+    double edit_ms = time_ms([&] {
+      for (int f = 0; f < frames; f++) {
+        patch[5].y += 0;
+        patch.points();
+      }
+    }) / frames;
+
+    long before = patch.evaluations();
+    double idle_ms = time_ms([&] {
+      for (int f = 0; f < frames; f++) {
+        patch.points();
+        patch.normals();
+      }
+    }) / frames;
+
+    std::cout << "per frame, 400 samples:\n"
+              << "  pow per term       " << old_ms*1e3 << " us (points)\n"
+              << "  basis, B G B^T     " << edit_ms*1e3 << " us (points), max diff " << max_error << "\n"
+              << "  normals vs finite differences, max diff " << normal_error << "\n"
+              << "  idle, cached       " << idle_ms*1e3 << " us, " << patch.evaluations() - before
+              << " evaluations in " << 3*frames << " frames" << std::endl;
+    return 0;
+  }
+
+  // Holding down one of the edit keys: a control point moves every frame
+  int edit(int argc, char *argv[]) {
+    int frames = argc > 0 ? std::atoi(argv[0]) : 1000;
+    const int keys[] = {5, 6, 9, 10};
+    Patch full, incremental;
+    bend(full);
+    bend(incremental);
+    full.points();
+    incremental.points();
+
+    // The wireframe view only needs points, the shaded one normals as well
+    auto run = [&](Patch& patch, bool incremental, bool shaded) {
+      return time_ms([&] {
+        for (int f = 0; f < frames; f++) {
+          int key = keys[f % 4], dim = f % 3;
+          double delta = f % 2 ? -5.0 : 5.0;
+          if (incremental) {
+            patch.move(key, dim, delta);
+          } else {
+            patch[key][dim] += delta;
+          }
+          patch.points();
+          if (shaded) {
+            patch.normals();
+          }
+        }
+      }, 1) / frames * 1e3;
+    };
+    double full_wire = run(full, false, false), move_wire = run(incremental, true, false);
+    double full_shaded = run(full, false, true), move_shaded = run(incremental, true, true);
+
+    std::cout << "per edited frame, 400 samples:\n"
+              << "  wireframe  full " << full_wire << " us, incremental " << move_wire << " us\n"
+              << "  shaded     full " << full_shaded << " us, incremental " << move_shaded << " us\n"
+              << "  " << incremental.evaluations() - 1 << " full evaluations on the incremental side, drift after "
+              << 2*frames << " edits: points " << max_diff(full.points(), incremental.points())
+              << ", normals " << max_diff(full.normals(), incremental.normals()) << std::endl;
+    return 0;
+  }
+
+  // How Patch::update filled its caches before they were split by
+  // coordinate: whole points, one coordinate at a time, 24 bytes apart
+  void samples_aos(const Patch& patch, std::vector<Patch::CPoint>& points, std::vector<Patch::CPoint>& du,
+                   std::vector<Patch::CPoint>& dv) {
+    int nu = patch.rows(), nv = patch.cols();
+    std::vector<double> bu(4*nu), dbu(4*nu), bv(4*nv), dbv(4*nv);
+    for (int s = 0; s < nu; s++) {
+      double u = patch.u_at(s), r = 1 - u;
+      double b[] = {r*r*r, 3*u*r*r, 3*u*u*r, u*u*u}, db[] = {-3*r*r, 3*r*r - 6*u*r, 6*u*r - 3*u*u, 3*u*u};
+      std::copy(b, b + 4, &bu[4*s]);
+      std::copy(db, db + 4, &dbu[4*s]);
+    }
+    for (int s = 0; s < nv; s++) {
+      double v = patch.v_at(s), r = 1 - v;
+      double b[] = {r*r*r, 3*v*r*r, 3*v*v*r, v*v*v}, db[] = {-3*r*r, 3*r*r - 6*v*r, 6*v*r - 3*v*v, 3*v*v};
+      std::copy(b, b + 4, &bv[4*s]);
+      std::copy(db, db + 4, &dbv[4*s]);
+    }
+    points.assign(nu*nv, Patch::CPoint{});
+    du.assign(nu*nv, Patch::CPoint{});
+    dv.assign(nu*nv, Patch::CPoint{});
+    std::vector<double> t(4*nv), dt(4*nv);
+    double Patch::CPoint::*coords[] = {&Patch::CPoint::x, &Patch::CPoint::y, &Patch::CPoint::z};
+    for (double Patch::CPoint::*c: coords) {
+      for (int i = 0; i < 4; i++) {
+        for (int v = 0; v < nv; v++) {
+          t[v + nv*i] = dt[v + nv*i] = 0;
+          for (int j = 0; j < 4; j++) {
+            t[v + nv*i] += patch[j+4*i].*c * bv[4*v + j];
+            dt[v + nv*i] += patch[j+4*i].*c * dbv[4*v + j];
+          }
+        }
+      }
+      const double *t0 = &t[0], *t1 = &t[nv], *t2 = &t[2*nv], *t3 = &t[3*nv];
+      const double *d0 = &dt[0], *d1 = &dt[nv], *d2 = &dt[2*nv], *d3 = &dt[3*nv];
+      for (int u = 0; u < nu; u++) {
+        const double *b = &bu[4*u], *db = &dbu[4*u];
+        Patch::CPoint *p = &points[nv*u], *su = &du[nv*u], *sv = &dv[nv*u];
+        for (int v = 0; v < nv; v++) {
+          p[v].*c = b[0]*t0[v] + b[1]*t1[v] + b[2]*t2[v] + b[3]*t3[v];
+          su[v].*c = db[0]*t0[v] + db[1]*t1[v] + db[2]*t2[v] + db[3]*t3[v];
+          sv[v].*c = b[0]*d0[v] + b[1]*d1[v] + b[2]*d2[v] + b[3]*d3[v];
+        }
+      }
+    }
+  }
+
+  // Samples (with both derivatives) per second: the old point-at-a-time
+  // layout against split coordinates, scalar and vectorized
+  int simd(int argc, char *argv[]) {
+    int frames = argc > 0 ? std::atoi(argv[0]) : 2000;
+    std::cout << "simd path: " << patch_isa() << ", million samples per second\n";
+    for (int n: {20, 40, 80}) {
+      Patch patch;
+      bend(patch);
+      patch.set_resolution(n);
+      int reps = std::max(1, frames * 400 / (n*n));
+      double samples = static_cast<double>(n)*n*reps;
+
+      std::vector<Patch::CPoint> points, du, dv;
+      double aos_ms = time_ms([&] {
+        for (int f = 0; f < reps; f++) {
+          samples_aos(patch, points, du, dv);
+        }
+      });
+      auto soa = [&](bool simd) {
+        patch.set_simd(simd);
+        return time_ms([&] {
+          for (int f = 0; f < reps; f++) {
+            patch[5].y += 0;
+            patch.samples();
+          }
+        });
+      };
+      double scalar_ms = soa(false);
+      double diff = max_diff(patch.points(), points);
+      double simd_ms = soa(true);
+      diff = std::max(diff, max_diff(patch.points(), points));
+
+      std::cout << "  " << n << "x" << n << ": points " << samples / aos_ms / 1e3
+                << ", split scalar " << samples / scalar_ms / 1e3
+                << ", split " << patch_isa() << " " << samples / simd_ms / 1e3
+                << ", max diff " << diff << std::endl;
+    }
+    return 0;
+  }
+
+  // Control points of the same curve at degree `to`, for p of degree n:
+  // q_i = sum_j C(n, j) C(to - n, i - j) / C(to, i) p_j
+  std::vector<Patch::CPoint> elevate(const std::vector<Patch::CPoint>& p, int to) {
+    auto choose = [](int n, int k) {
+      double c = 1;
+      for (int i = 0; i < k; i++) {
+        c = c * (n - i) / (i + 1);
+      }
+      return k < 0 || k > n ? 0.0 : c;
+    };
+    int n = static_cast<int>(p.size()) - 1;
+    std::vector<Patch::CPoint> q(to + 1);
+    for (int i = 0; i <= to; i++) {
+      for (int j = 0; j <= n; j++) {
+        double w = choose(n, j) * choose(to - n, i - j) / choose(to, i);
+        q[i].x += w*p[j].x;
+        q[i].y += w*p[j].y;
+        q[i].z += w*p[j].z;
+      }
+    }
+    return q;
+  }
+
+  template <int M, int N>
+  void time_degree(int frames) {
+    BezierPatch<M, N> patch;
+    bend(patch);
+    double us = time_ms([&] {
+      for (int f = 0; f < frames; f++) {
+        patch[0].y += 0;
+        patch.samples();
+      }
+    }) / frames * 1e3;
+    std::cout << "  degree " << M << "x" << N << ", " << BezierPatch<M, N>::kRows*BezierPatch<M, N>::kCols
+              << " control points: " << us << " us, " << 400 / us << " million samples per second" << std::endl;
+  }
+
+  // Evaluation cost by degree, and a bicubic patch raised to degree 5
+  // drawing the same surface
+  int degree(int argc, char *argv[]) {
+    int frames = argc > 0 ? std::atoi(argv[0]) : 2000;
+    std::cout << "full evaluation at 20x20 with both derivatives, " << patch_isa() << ":\n";
+    time_degree<1, 1>(frames);
+    time_degree<2, 2>(frames);
+    time_degree<3, 3>(frames);
+    time_degree<5, 5>(frames);
+
+    Patch cubic;
+    bend(cubic);
+    std::vector<std::vector<Patch::CPoint>> rows;
+    for (int i = 0; i < 4; i++) {
+      std::vector<Patch::CPoint> row;
+      for (int j = 0; j < 4; j++) {
+        row.push_back(cubic[j + 4*i]);
+      }
+      rows.push_back(elevate(row, 5));
+    }
+    BezierPatch<5, 5> quintic;
+    for (int j = 0; j < 6; j++) {
+      std::vector<Patch::CPoint> column;
+      for (int i = 0; i < 4; i++) {
+        column.push_back(rows[i][j]);
+      }
+      auto raised = elevate(column, 5);
+      for (int i = 0; i < 6; i++) {
+        quintic[j + 6*i] = raised[i];
+      }
+    }
+    std::cout << "  bicubic vs raised to 5x5, max diff " << max_diff(cubic.points(), quintic.points())
+              << ", normals " << max_diff(cubic.normals(), quintic.normals()) << std::endl;
+    return 0;
+  }
+
+  // Worst distance between the surface and the flat quads drawn for it,
+  // checked at each quad's centre
+  double chord_error(const Patch& patch, const std::vector<Patch::CPoint>& pts) {
+    double worst = 0;
+    int n = patch.cols();
+    for (int i = 0; i + 1 < patch.rows(); i++) {
+      for (int j = 0; j + 1 < n; j++) {
+        auto s = patch.evaluate((patch.u_at(i) + patch.u_at(i+1)) / 2, (patch.v_at(j) + patch.v_at(j+1)) / 2);
+        auto q = pts[j + n*i];
+        q += pts[j+1 + n*i];
+        q += pts[j + n*(i+1)];
+        q += pts[j+1 + n*(i+1)];
+        q = q / 4.0;
+        worst = std::max(worst, sqrt((s.x - q.x)*(s.x - q.x) + (s.y - q.y)*(s.y - q.y) + (s.z - q.z)*(s.z - q.z)));
+      }
+    }
+    return worst;
+  }
+
+  // Fixed sample counts against the hull test, on patches of different
+  // curvature seen from the default camera
+  int tess(int argc, char *argv[]) {
+    int frames = argc > 0 ? std::atoi(argv[0]) : 200;
+    // 480 pixels high, 60 degrees, from (45, 45, 45)
+    double ppu = 480 / (2*sqrt(3*45.0*45.0)*tan(M_PI / 6));
+
+    Patch flat, bent, rolled;
+    bend(bent);
+    for (int k = 0; k < 16; k++) {
+      rolled[k].y = (k / 4 == 1 || k / 4 == 2) ? 40 : 0;
+    }
+    struct Shape { const char *name; Patch *patch; } shapes[] = {
+      {"flat", &flat}, {"bent", &bent}, {"curved in u", &rolled},
+    };
+
+    std::cout << "error in pixels at " << ppu << " px per unit, times per evaluation\n";
+    for (auto& shape: shapes) {
+      Patch& patch = *shape.patch;
+      auto report = [&](const std::string& mode, double params_us) {
+        double eval_us = time_ms([&] {
+          for (int f = 0; f < frames; f++) {
+            patch[5].y += 0;
+            patch.points();
+          }
+        }) / frames * 1e3;
+        std::cout << "  " << shape.name << ", " << mode << ": " << patch.rows() << "x" << patch.cols()
+                  << ", " << patch.triangle_count() << " triangles, " << eval_us << " us";
+        if (params_us > 0) {
+          std::cout << " + " << params_us << " us placing samples";
+        }
+        std::cout << ", error " << chord_error(patch, patch.points()) * ppu << std::endl;
+      };
+      for (int n: {10, 20, 40, 80}) {
+        patch.set_resolution(n);
+        report("uniform " + std::to_string(n), 0);
+      }
+      for (double tolerance: {4.0, 1.0, 0.25}) {
+        double params_us = time_ms([&] {
+          for (int f = 0; f < frames; f++) {
+            patch[5].y += 0;
+            patch.set_adaptive(tolerance, ppu);
+          }
+        }) / frames * 1e3;
+        report("adaptive " + std::to_string(tolerance).substr(0, 4) + " px", params_us);
+      }
+    }
+    return 0;
+  }
+
+  // k x k patches around a bumpy torus. Every other patch runs the opposite
+  // way in both u and v, so seams meet either way round.
+  PatchMesh torus(int k, unsigned threads) {
+    int n = 3*k;
+    std::vector<Patch::CPoint> vertices;
+    for (int a = 0; a < n; a++) {
+      for (int b = 0; b < n; b++) {
+        double theta = 2*M_PI*a/n, phi = 2*M_PI*b/n, r = 10 + 2*sin(3*theta);
+        vertices.push_back(Patch::CPoint((30 + r*cos(phi))*cos(theta), r*sin(phi), (30 + r*cos(phi))*sin(theta)));
+      }
+    }
+    std::vector<std::array<int, 16>> patches;
+    for (int pa = 0; pa < k; pa++) {
+      for (int pb = 0; pb < k; pb++) {
+        bool flip = (pa + pb) % 2;
+        std::array<int, 16> patch;
+        for (int i = 0; i < 4; i++) {
+          for (int j = 0; j < 4; j++) {
+            int a = (3*pa + (flip ? 3 - i : i)) % n, b = (3*pb + (flip ? 3 - j : j)) % n;
+            patch[j+4*i] = b + n*a;
+          }
+        }
+        patches.push_back(patch);
+      }
+    }
+    return PatchMesh(vertices, patches, threads);
+  }
+
+  // Re-tessellating everything and a single edit, on 1 to N threads
+  int mesh(int argc, char *argv[]) {
+    std::string source = argc > 0 ? argv[0] : "8";
+    int frames = argc > 1 ? std::atoi(argv[1]) : 50;
+    auto make = [&](unsigned threads) {
+      return std::isdigit(source[0]) ? torus(std::atoi(source.c_str()), threads) : PatchMesh::load(source, threads);
+    };
+
+    PatchMesh shape = make(1);
+    shape.update();
+    std::cout << shape.size() << " patches, " << shape.vertices().size() << " vertices, "
+              << shape.triangle_count() << " triangles at 20x20\n"
+              << "  seam gap evaluated per patch " << shape.seam_gap(false) << ", stitched " << shape.seam_gap()
+              << "\n";
+    for (double tolerance: {1.0, 0.25}) {
+      shape.set_adaptive(tolerance, 5.0);
+      shape.update();
+      std::cout << "  adaptive " << tolerance << " px at 5 px per unit: " << shape.triangle_count()
+                << " triangles, stitched seam gap " << shape.seam_gap() << "\n";
+    }
+
+    // Nudging one vertex of a 4x4 torus and putting it back has to give the
+    // normals a fresh mesh has, with every patch agreeing along seams and
+    // at corners
+    PatchMesh fresh = torus(4, 1), edited = torus(4, 1);
+    fresh.update();
+    edited.update();
+    for (int i = 0; i < 50; i++) {
+      edited.move(13, 1, 3);
+      edited.update();
+      edited.move(13, 1, -3);
+      edited.update();
+    }
+    double drift = 0;
+    for (std::size_t p = 0; p < fresh.size(); p++) {
+      drift = std::max(drift, max_diff(fresh.normals(p), edited.normals(p)));
+    }
+    std::cout << "  torus vertex moved and back 50 times: normals drift " << drift
+              << ", widest normal gap between patches " << edited.seam_normal_gap() << "\n";
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    double one = 0;
+    std::cout << cores << " cores, per frame:" << std::endl;
+    for (unsigned threads = 1; threads <= std::max(2u, cores); threads++) {
+      PatchMesh m = make(threads);
+      m.update();
+      int vertices = static_cast<int>(m.vertices().size());
+      double full_ms = time_ms([&] {
+        for (int f = 0; f < frames; f++) {
+          for (int v = 0; v < vertices; v++) {
+            m.move(v, 0, 0);
+          }
+          m.update();
+        }
+      }) / frames;
+      long before = m.evaluations();
+      double edit_ms = time_ms([&] {
+        for (int f = 0; f < frames; f++) {
+          m.move(f % vertices, 1, f % 2 ? -0.5 : 0.5);
+          m.update();
+        }
+      }, 1) / frames;
+      if (threads == 1) {
+        one = full_ms;
+      }
+      std::cout << "  " << threads << " threads: all patches " << full_ms << " ms (" << one / full_ms
+                << "x), one vertex moved " << edit_ms*1e3 << " us, "
+                << static_cast<double>(m.evaluations() - before) / frames << " patches re-evaluated" << std::endl;
+    }
+    return 0;
+  }
+
+  struct Bench {
+    const char *name;
+    int (*run)(int, char *[]);
+    const char *usage;
+  };
+
+  const Bench benches[] = {
+    {"eval", eval, "[frames]  surface evaluation per frame: old pow terms, basis matrices, cached"},
+    {"degree", degree, "[frames]  evaluation time per patch degree, degree elevation check"},
+    {"edit", edit, "[frames]  one control point moved per frame, full vs incremental update"},
+    {"mesh", mesh, "[patches per side | file] [frames]  patch set evaluation on 1 to N threads, seam gaps"},
+    {"simd", simd, "[frames]  evaluation throughput, whole points vs split coordinates, scalar vs SIMD"},
+    {"tess", tess, "[frames]  triangles, evaluation time and error for uniform and adaptive sampling"},
+  };
+}
+
+int run_bench(int argc, char *argv[]) {
+  if (argc > 0) {
+    for (auto& b: benches) {
+      if (std::strcmp(argv[0], b.name) == 0) {
+        try {
+          int status = b.run(argc - 1, argv + 1);
+          if (status >= 0) {
+            return status;
+          }
+          std::cerr << "usage: graphics bench " << b.name << " " << b.usage << std::endl;
+        } catch (const std::runtime_error& e) {
+          std::cerr << e.what() << std::endl;
+        }
+        return 1;
+      }
+    }
+  }
+  std::cerr << "usage: graphics bench <name> [args...]\n";
+  for (auto& b: benches) {
+    std::cerr << "  " << b.name << " " << b.usage << "\n";
+  }
+  return 1;
+}
@@ -1,13 +1,20 @@
 #include "Patch.hpp"
+#include "Profiler.hpp"
 
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
-#include <GLUT/glut.h>
 
+#include <algorithm>
+#include <array>
+#include <type_traits>
 #include <math.h>
 #include <iostream>
 
-double& Patch::CPoint::operator[](int i) {
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+double& PatchBase::CPoint::operator[](int i) {
   switch (i) {
     case 0:
       return x;
@@ -20,46 +27,289 @@ double& Patch::CPoint::operator[](int i) {
   }
 }
 
-Patch::CPoint Patch::CPoint::operator-(const Patch::CPoint& o) {
-  return Patch::CPoint(x-o.x, y-o.y, z-o.z);
+PatchBase::CPoint PatchBase::CPoint::operator-(const CPoint& o) {
+  return CPoint(x-o.x, y-o.y, z-o.z);
 }
 
-Patch::CPoint Patch::CPoint::unit() {
+PatchBase::CPoint PatchBase::CPoint::unit() {
   double len = sqrt(x*x + y*y + z*z);
-  return Patch::CPoint(x/len, y/len, z/len);
+  return CPoint(x/len, y/len, z/len);
+}
+
+template <int M, int N>
+BezierPatch<M, N>::BezierPatch(): adaptive_{false}, tolerance_{0}, pixels_per_unit_{0}, dirty_{true},
+                                  interleaved_{false}, simd_{true}, stale_{0, 0, 0, 0}, evaluations_{0} {
+  // A flat 60x60 grid
+  for (int i = 0; i < kRows; i++) {
+    for (int j = 0; j < kCols; j++) {
+      coords_[j + kCols*i] = CPoint{i*60.0/M, 0.0, j*60.0/N};
+    }
+  }
+  set_resolution(20);
 }
 
-Patch::Patch() {
-  coords_ = std::vector<CPoint>{16};
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      coords_[j+4*i] = CPoint{i*20.0, 0.0, j*20.0};
+namespace {
+  // Halving stops here, at 65 samples along a side
+  const int kMaxDepth = 6;
+
+  // C(n, k)
+  constexpr long binomial(int n, int k) {
+    return k < 0 || k > n ? 0 : k == 0 || k == n ? 1 : binomial(n - 1, k - 1) + binomial(n - 1, k);
+  }
+
+  template <int K>
+  struct Pow {
+    static double of(double x) { return x * Pow<K - 1>::of(x); }
+  };
+
+  template <>
+  struct Pow<0> {
+    static double of(double) { return 1; }
+  };
+
+  // b[k] = C(D, k) t^k (1 - t)^(D - k) for k <= K, one term per
+  // instantiation so there's no loop left over the degree
+  template <int D, int K = D>
+  struct Bernstein {
+    static void eval(double t, double *b) {
+      Bernstein<D, K - 1>::eval(t, b);
+      b[K] = std::integral_constant<long, binomial(D, K)>::value * Pow<K>::of(t) * Pow<D - K>::of(1 - t);
+    }
+  };
+
+  template <int D>
+  struct Bernstein<D, -1> {
+    static void eval(double, double *) {}
+  };
+
+  // b'[k] = D (B[k-1] - B[k]) in degree D - 1, with zeros past either end
+  template <int D, int K = D>
+  struct BernsteinSlope {
+    static void eval(const double *lower, double *d) {
+      BernsteinSlope<D, K - 1>::eval(lower, d);
+      d[K] = D * (lower[K] - lower[K + 1]);
     }
+  };
+
+  template <int D>
+  struct BernsteinSlope<D, -1> {
+    static void eval(const double *, double *) {}
+  };
+
+  template <int D>
+  inline void bernstein(double t, double *b) {
+    Bernstein<D>::eval(t, b);
+  }
+
+  template <int D>
+  inline void bernstein_slope(double t, double *d) {
+    double lower[D + 2] = {};
+    Bernstein<D - 1>::eval(t, lower + 1);
+    BernsteinSlope<D>::eval(lower, d);
+  }
+
+  inline Patch::CPoint lerp(const Patch::CPoint& p, const Patch::CPoint& q, double t) {
+    return Patch::CPoint(p.x + t*(q.x - p.x), p.y + t*(q.y - p.y), p.z + t*(q.z - p.z));
+  }
+
+  // Control points of the degree D curve over [a, b] of its parameter: de
+  // Casteljau at b keeps the part left of it, then at a / b the part of
+  // that to the right
+  template <int D>
+  void segment(const Patch::CPoint *p, double a, double b, Patch::CPoint *q) {
+    Patch::CPoint r[D + 1], left[D + 1];
+    std::copy(p, p + D + 1, r);
+    left[0] = r[0];
+    for (int level = 1; level <= D; level++) {
+      for (int k = 0; k + level <= D; k++) {
+        r[k] = lerp(r[k], r[k+1], b);
+      }
+      left[level] = r[0];
+    }
+    double t = a / b;
+    q[D] = left[D];
+    for (int level = 1; level <= D; level++) {
+      for (int k = 0; k + level <= D; k++) {
+        left[k] = lerp(left[k], left[k+1], t);
+      }
+      q[D - level] = left[D - level];
+    }
+  }
+
+  // How far the degree D curve over [a, b] can stray from its chord:
+  // D(D-1)/8 of the largest second difference of its control points there
+  template <int D>
+  double bend(const Patch::CPoint *p, double a, double b) {
+    Patch::CPoint q[D + 1];
+    segment<D>(p, a, b, q);
+    double worst = 0;
+    for (int k = 0; k + 2 <= D; k++) {
+      double dx = q[k].x - 2*q[k+1].x + q[k+2].x;
+      double dy = q[k].y - 2*q[k+1].y + q[k+2].y;
+      double dz = q[k].z - 2*q[k+1].z + q[k+2].z;
+      worst = std::max(worst, dx*dx + dy*dy + dz*dz);
+    }
+    return D*(D - 1) / 8.0 * sqrt(worst);
+  }
+
+  // Appends the end of every interval of [a, b] that ends up flat enough
+  template <int D>
+  void split(const std::vector<std::array<Patch::CPoint, D + 1>>& curves, double a, double b, int depth,
+             double limit, std::vector<double>& out) {
+    double worst = 0;
+    for (auto& curve: curves) {
+      worst = std::max(worst, bend<D>(curve.data(), a, b));
+    }
+    if (worst > limit && depth < kMaxDepth) {
+      split<D>(curves, a, (a + b) / 2, depth + 1, limit, out);
+      split<D>(curves, (a + b) / 2, b, depth + 1, limit, out);
+    } else {
+      out.push_back(b);
+    }
+  }
+}
+
+namespace {
+  std::vector<double> uniform_params(int samples) {
+    samples = std::max(2, samples);
+    std::vector<double> params(samples);
+    for (int s = 0; s < samples; s++) {
+      params[s] = s / static_cast<double>(samples - 1);
+    }
+    return params;
+  }
+}
+
+template <int M, int N>
+void BezierPatch<M, N>::set_resolution(int samples) {
+  set_resolution(samples, samples);
+}
+
+template <int M, int N>
+void BezierPatch<M, N>::set_resolution(int rows, int cols) {
+  adaptive_ = false;
+  set_params(uniform_params(rows), uniform_params(cols));
+}
+
+template <int M, int N>
+void BezierPatch<M, N>::set_adaptive(double tolerance, double pixels_per_unit) {
+  // Nothing moved since the samples were placed, so they'd land in the same spots
+  if (adaptive_ && !dirty_ && tolerance == tolerance_ && pixels_per_unit == pixels_per_unit_) {
+    return;
   }
+  adaptive_ = true;
+  tolerance_ = tolerance;
+  pixels_per_unit_ = pixels_per_unit;
+  set_params(adaptive_params(0, tolerance_, pixels_per_unit_), adaptive_params(1, tolerance_, pixels_per_unit_));
 }
 
-int binomial3(int k) {
-  int vals[] = {1, 3, 3, 1};
-  return vals[k];
+template <int M, int N>
+int BezierPatch<M, N>::adaptive_samples(int axis, double tolerance, double pixels_per_unit) const {
+  return static_cast<int>(adaptive_params(axis, tolerance, pixels_per_unit).size());
+}
+
+// Every v is a blend of the curves running along u, so the surface over a
+// u interval is no bendier than the worst of them (and likewise the other
+// way)
+template <int M, int N>
+std::vector<double> BezierPatch<M, N>::adaptive_params(int axis, double tolerance, double pixels_per_unit) const {
+  std::vector<double> params{0};
+  // A quad can be off the surface by the bend along u plus the bend along
+  // v, so each axis gets half the tolerance
+  double limit = 0.5*tolerance / std::max(pixels_per_unit, 1e-9);
+  if (axis == 0) {
+    std::vector<std::array<CPoint, kRows>> curves(kCols);
+    for (int c = 0; c < kCols; c++) {
+      for (int k = 0; k < kRows; k++) {
+        curves[c][k] = coords_[c + kCols*k];
+      }
+    }
+    split<M>(curves, 0, 1, 0, limit, params);
+  } else {
+    std::vector<std::array<CPoint, kCols>> curves(kRows);
+    for (int c = 0; c < kRows; c++) {
+      for (int k = 0; k < kCols; k++) {
+        curves[c][k] = coords_[k + kCols*c];
+      }
+    }
+    split<N>(curves, 0, 1, 0, limit, params);
+  }
+  return params;
 }
 
-double Patch::bernstein4(int i, double u) {
-  return binomial3(i) * pow(u/20.0, i) * pow(1-u/20.0, 3-i);
+// Only a change of parameters throws the samples away
+template <int M, int N>
+void BezierPatch<M, N>::set_params(const std::vector<double>& us, const std::vector<double>& vs) {
+  if (us == us_ && vs == vs_) {
+    return;
+  }
+  us_ = us;
+  vs_ = vs;
+  std::size_t nv = vs_.size();
+  bu_.resize(kRows*us_.size());
+  bv_.resize(kCols*nv);
+  dbu_.resize(kRows*us_.size());
+  dbv_.resize(kCols*nv);
+  for (std::size_t s = 0; s < us_.size(); s++) {
+    bernstein<M>(us_[s], &bu_[kRows*s]);
+    bernstein_slope<M>(us_[s], &dbu_[kRows*s]);
+  }
+  for (std::size_t s = 0; s < nv; s++) {
+    double b[kCols], db[kCols];
+    bernstein<N>(vs_[s], b);
+    bernstein_slope<N>(vs_[s], db);
+    for (std::size_t k = 0; k < kCols; k++) {
+      bv_[s + nv*k] = b[k];
+      dbv_[s + nv*k] = db[k];
+    }
+  }
+  dirty_ = true;
 }
 
-inline Patch::CPoint Patch::bezier_param(double u, double v) {
-  Patch::CPoint p;
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      auto b = bernstein4(i, u)*bernstein4(j, v);
-      p.x += b*coords_[j+4*i].x;
-      p.y += b*coords_[j+4*i].y;
-      p.z += b*coords_[j+4*i].z;
+template <int M, int N>
+PatchBase::CPoint BezierPatch<M, N>::evaluate(double u, double v) const {
+  double bu[kRows], bv[kCols];
+  bernstein<M>(u, bu);
+  bernstein<N>(v, bv);
+  CPoint p;
+  for (int i = 0; i < kRows; i++) {
+    for (int j = 0; j < kCols; j++) {
+      double b = bu[i]*bv[j];
+      p.x += b*coords_[j + kCols*i].x;
+      p.y += b*coords_[j + kCols*i].y;
+      p.z += b*coords_[j + kCols*i].z;
     }
   }
   return p;
 }
 
+namespace {
+  // Sv x Su, which faces the same way the old per-triangle normals did
+  inline Patch::CPoint surface_normal(const Patch::CPoint& sv, const Patch::CPoint& su) {
+    return Patch::CPoint(sv.y*su.z - sv.z*su.y, sv.z*su.x - sv.x*su.z, sv.x*su.y - sv.y*su.x);
+  }
+
+  template <int M, int N>
+  void derivatives(const std::array<Patch::CPoint, (M + 1)*(N + 1)>& coords, double u, double v,
+                   Patch::CPoint& su, Patch::CPoint& sv) {
+    double bu[M + 1], bv[N + 1], dbu[M + 1], dbv[N + 1];
+    bernstein<M>(u, bu);
+    bernstein<N>(v, bv);
+    bernstein_slope<M>(u, dbu);
+    bernstein_slope<N>(v, dbv);
+    su = sv = Patch::CPoint{};
+    for (int i = 0; i <= M; i++) {
+      for (int j = 0; j <= N; j++) {
+        for (int c = 0; c < 3; c++) {
+          Patch::CPoint p = coords[j + (N + 1)*i];
+          su[c] += dbu[i]*bv[j]*p[c];
+          sv[c] += bu[i]*dbv[j]*p[c];
+        }
+      }
+    }
+  }
+}
+
 inline Patch::CPoint normal(Patch::CPoint p1, Patch::CPoint p2, Patch::CPoint p3) {
   auto u = p2 - p1;
   auto v = p3 - p1;
@@ -72,40 +322,99 @@ bool is_bfc(Patch::CPoint p1, Patch::CPoint p2, Patch::CPoint p3, double vx, dou
   return n.x*vx + n.y*vy + n.z*vz >= 0;
 }
 
-void Patch::draw(double vx, double vy, double vz) {
+// The sphere markers are drawn from, with glutSolidSphere(1, 10, 10)'s
+// tessellation: a vertex at each pole and 9 rings of 10 around the z axis.
+// On a unit sphere each vertex is its own normal.
+struct Sphere {
+  std::vector<GLfloat> vertices;
+  std::vector<GLushort> indices;
+
+  Sphere() {
+    const int slices = 10, stacks = 10;
+    vertices = {0, 0, 1};
+    for (int i = 1; i < stacks; i++) {
+      for (int j = 0; j < slices; j++) {
+        double a = 2*M_PI*j/slices, b = M_PI*i/stacks;
+        vertices.insert(vertices.end(), {GLfloat(cos(a)*sin(b)), GLfloat(sin(a)*sin(b)), GLfloat(cos(b))});
+      }
+    }
+    vertices.insert(vertices.end(), {0, 0, -1});
+    GLushort south = vertices.size()/3 - 1;
+    for (int j = 0; j < slices; j++) {
+      GLushort next = (j + 1) % slices;
+      indices.insert(indices.end(), {0, GLushort(1 + j), GLushort(1 + next)});
+      GLushort a = 1 + (stacks - 2)*slices;
+      indices.insert(indices.end(), {south, GLushort(a + next), GLushort(a + j)});
+      for (int i = 0; i < stacks - 2; i++) {
+        GLushort top = 1 + i*slices, bottom = top + slices;
+        indices.insert(indices.end(), {GLushort(top + j), GLushort(bottom + j), GLushort(bottom + next),
+                                       GLushort(top + j), GLushort(bottom + next), GLushort(top + next)});
+      }
+    }
+  }
+};
+
+// One sphere of `radius` at each of `count` points. The mesh is built once
+// and bound once; each marker only moves the modelview.
+void draw_spheres(const Patch::CPoint* centers, int count, double radius) {
+  static const Sphere sphere;
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, sphere.vertices.data());
+  glNormalPointer(GL_FLOAT, 0, sphere.vertices.data());
+  for (int i = 0; i < count; i++) {
+    glPushMatrix();
+    glTranslated(centers[i].x, centers[i].y, centers[i].z);
+    glScaled(radius, radius, radius);
+    glDrawElements(GL_TRIANGLES, sphere.indices.size(), GL_UNSIGNED_SHORT, sphere.indices.data());
+    glPopMatrix();
+  }
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Round points covering what unlit spheres of `radius` at pts would, in a
+// single draw straight from the array. A point's size falls off with its
+// eye distance d as 1/d, so it is set to the sphere's diameter in pixels at
+// d = 1: the radius times the projection's y scale times the viewport height.
+void draw_dots(const std::vector<Patch::CPoint>& pts, double radius) {
+  GLfloat projection[16];
+  GLint viewport[4];
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  double diameter = radius*projection[5]*viewport[3];
+  GLfloat attenuation[] = {0, 0, GLfloat(1/(diameter*diameter))}, constant[] = {1, 0, 0};
+  glPointParameterfv(GL_POINT_DISTANCE_ATTENUATION, attenuation);
+  glEnable(GL_POINT_SMOOTH);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_DOUBLE, sizeof(Patch::CPoint), pts.data());
+  glDrawArrays(GL_POINTS, 0, pts.size());
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisable(GL_POINT_SMOOTH);
+  glPointParameterfv(GL_POINT_DISTANCE_ATTENUATION, constant);
+}
+
+template <int M, int N>
+void BezierPatch<M, N>::draw(double vx, double vy, double vz) {
+  PROFILE_SCOPE("Patch::draw");
   glPushMatrix();
   glTranslatef(-30, 0, -30);
 
   // Control points
   glColor3f(1.0, 1.0, 1.0);
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      glPushMatrix();
-      Patch::CPoint cp = coords_[j+4*i];
-      glTranslatef(cp.x, cp.y, cp.z);
-      glutSolidSphere(1, 10, 10);
-      glPopMatrix();
-    }
-  }
-
-  // Bezier surface points
-  std::vector<Patch::CPoint> pts;
-  for (int u = 0; u < 20; u++) {
-    for (int v = 0; v < 20; v++) {
-      pts.push_back(bezier_param(u, v));
-    }
-  }
-  // std::cerr << pts.size() << std::endl;
+  draw_spheres(coords_.data(), kRows*kCols, 1);
 
+  const Soa& pts = samples();
+  int n = cols();
 
   // Draw surfaces
   glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  for (int i = 0; i < 19; i++) {
-    for (int j = 0; j < 19; j++) {
-      auto p1 = pts[j + 20*i];
-      auto p2 = pts[j+1 + 20*i];
-      auto p3 = pts[j + 20*(i+1)];
-      auto p4 = pts[j+1 + 20*(i+1)];
+  for (int i = 0; i < rows() - 1; i++) {
+    for (int j = 0; j < n - 1; j++) {
+      auto p1 = pts[j + n*i];
+      auto p2 = pts[j+1 + n*i];
+      auto p3 = pts[j + n*(i+1)];
+      auto p4 = pts[j+1 + n*(i+1)];
       glColor3f(0.0, 1.0, 0.0);
       glBegin(GL_TRIANGLE_STRIP);
       // Face one
@@ -125,15 +434,7 @@ void Patch::draw(double vx, double vy, double vz) {
   glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
   glColor3f(0.0, 0.5, 1.0);
-  for (int i = 0; i < 20; i++) {
-    for (int j = 0; j < 20; j++) {
-      auto p1 = pts[j + 20*i];
-      glPushMatrix();
-      glTranslatef(p1.x, p1.y, p1.z);
-      glutSolidSphere(0.2, 10, 10);
-      glPopMatrix();
-    }
-  }
+  draw_dots(points(), 0.2);
 
   glPopMatrix();
 }
@@ -143,72 +444,18 @@ inline void cpToGl(Patch::CPoint p, GLfloat vs[3]) {
 }
 
 template <int M, int N>
-bool in_bounds(std::pair<int, int> c) {
-  return c.first >= 0 && c.second >= 0 && c.first < M && c.second < N;
-}
-
-Patch::CPoint average_normal(const std::vector<Patch::CPoint> pts, int i, int j) {
-  /*
-
-   * - a - b
-   | / | / |
-   f - o - c
-   | / | / |
-   e - d - *
-
-   neighbors: a(0, 1), b(1, 1), c(1, 0), d(0, -1), e(-1, -1), f(-1, 0)
-
-  */
-
-  std::vector<std::pair<int, int> > neighbors = {
-    { j,   i-1}, // a
-    { j+1, i-1}, // b
-    { j+1, i},   // c
-    { j,   i+1}, // d
-    {j-1,  i+1}, // e
-    {j-1,  i},   // f
-  };
-  std::vector<Patch::CPoint> norms;
-  for (auto it = neighbors.begin()+1; it != neighbors.end(); it++) {
-    auto v1 = *(it-1);
-    auto v2 = *it;
-    if (in_bounds<20, 20>(v1) && in_bounds<20, 20>(v2)) {
-      norms.push_back(normal(pts[j+20*i],
-                             pts[v1.first+20*v1.second],
-                             pts[v2.first+20*v2.second]));
-    }
-  }
-  Patch::CPoint avg_norm;
-  for (auto& n: norms) {
-    avg_norm += n;
-  }
-  return avg_norm / static_cast<double>(norms.size());
-}
-
-void Patch::shade(double vx, double vy, double vz, double shininess, GLfloat diffuse) {
+void BezierPatch<M, N>::shade(double vx, double vy, double vz, double shininess, GLfloat diffuse) {
+  PROFILE_SCOPE("Patch::shade");
   glPushMatrix();
   glTranslatef(-30, 0, -30);
 
   // Control points
   glColor3f(1.0, 1.0, 1.0);
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      glPushMatrix();
-      Patch::CPoint cp = coords_[j+4*i];
-      glTranslatef(cp.x, cp.y, cp.z);
-      glutSolidSphere(1, 10, 10);
-      glPopMatrix();
-    }
-  }
+  draw_spheres(coords_.data(), kRows*kCols, 1);
 
-  // Bezier surface points
-  std::vector<Patch::CPoint> pts;
-  for (int u = 0; u < 20; u++) {
-    for (int v = 0; v < 20; v++) {
-      pts.push_back(bezier_param(u, v));
-    }
-  }
-  // std::cerr << pts.size() << std::endl;
+  const Soa& pts = samples();
+  const std::vector<Patch::CPoint>& norms = normals();
+  int n = cols();
   GLfloat a_reflection[] = { 0.0, 0.7, 0.0, 1.0 };
   GLfloat d_reflection[] = { 0.0, diffuse, 0.0, 1.0 };
   GLfloat s_reflection[] = { 1.0, 1.0, 1.0, 1.0 };
@@ -220,43 +467,42 @@ void Patch::shade(double vx, double vy, double vz, double shininess, GLfloat dif
 
   // Draw surfaces
   glColor3f(0.0, 1.0, 0.0);
-  for (int i = 0; i < 19; i++) {
-    for (int j = 0; j < 19; j++) {
-      auto p1 = pts[j + 20*i];
-      auto p2 = pts[j+1 + 20*i];
-      auto p3 = pts[j + 20*(i+1)];
-      auto p4 = pts[j+1 + 20*(i+1)];
-      Patch::CPoint n;
+  for (int i = 0; i < rows() - 1; i++) {
+    for (int j = 0; j < n - 1; j++) {
+      auto p1 = pts[j + n*i];
+      auto p2 = pts[j+1 + n*i];
+      auto p3 = pts[j + n*(i+1)];
+      auto p4 = pts[j+1 + n*(i+1)];
+      Patch::CPoint norm;
 
       glBegin(GL_TRIANGLES);
       // Face one
       if (is_bfc(p1, p2, p3, vx, vy, vz)) {
-        n = average_normal(pts, i, j);
-        // std::cerr << n << std::endl;
-        glNormal3f(n.x, n.y, n.z);
+        norm = norms[j + n*i];
+        glNormal3f(norm.x, norm.y, norm.z);
         glVertex3f(p1.x, p1.y, p1.z);
 
-        n = average_normal(pts, i, j+1);
-        glNormal3f(n.x, n.y, n.z);
+        norm = norms[j+1 + n*i];
+        glNormal3f(norm.x, norm.y, norm.z);
         glVertex3f(p2.x, p2.y, p2.z);
 
-        n = average_normal(pts, i+1, j);
-        glNormal3f(n.x, n.y, n.z);
+        norm = norms[j + n*(i+1)];
+        glNormal3f(norm.x, norm.y, norm.z);
         glVertex3f(p3.x, p3.y, p3.z);
       }
 
       // Face two
       if (is_bfc(p3, p2, p4, vx, vy, vz)) {
-        n = average_normal(pts, i+1, j);
-        glNormal3f(n.x, n.y, n.z);
+        norm = norms[j + n*(i+1)];
+        glNormal3f(norm.x, norm.y, norm.z);
         glVertex3f(p3.x, p3.y, p3.z);
 
-        n = average_normal(pts, i, j+1);
-        glNormal3f(n.x, n.y, n.z);
+        norm = norms[j+1 + n*i];
+        glNormal3f(norm.x, norm.y, norm.z);
         glVertex3f(p2.x, p2.y, p2.z);
 
-        n = average_normal(pts, i+1, j+1);
-        glNormal3f(n.x, n.y, n.z);
+        norm = norms[j+1 + n*(i+1)];
+        glNormal3f(norm.x, norm.y, norm.z);
         glVertex3f(p4.x, p4.y, p4.z);
       }
       glEnd();
@@ -266,21 +512,274 @@ void Patch::shade(double vx, double vy, double vz, double shininess, GLfloat dif
   glPopMatrix();
 }
 
-Patch::CPoint& Patch::operator[](int i) {
+template <int M, int N>
+PatchBase::CPoint& BezierPatch<M, N>::operator[](int i) {
+  dirty_ = true;
+  return coords_[i];
+}
+
+template <int M, int N>
+const PatchBase::CPoint& BezierPatch<M, N>::operator[](int i) const {
   return coords_[i];
 }
 
-Patch::CPoint& Patch::CPoint::operator+=(const Patch::CPoint& pt) {
+template <int M, int N>
+const PatchBase::Soa& BezierPatch<M, N>::samples() {
+  update();
+  return samples_;
+}
+
+template <int M, int N>
+const std::vector<PatchBase::CPoint>& BezierPatch<M, N>::points() {
+  update();
+  if (!interleaved_) {
+    points_.resize(samples_.size());
+    for (std::size_t k = 0; k < points_.size(); k++) {
+      points_[k] = samples_[k];
+    }
+    interleaved_ = true;
+  }
+  return points_;
+}
+
+template <int M, int N>
+void BezierPatch<M, N>::set_simd(bool simd) {
+  dirty_ = dirty_ || simd != simd_;
+  simd_ = simd;
+}
+
+template <int M, int N>
+const std::vector<PatchBase::CPoint>& BezierPatch<M, N>::normals() {
+  update();
+  normals_.resize(samples_.size());
+  for (int i = stale_[0]; i < stale_[1]; i++) {
+    for (int j = stale_[2]; j < stale_[3]; j++) {
+      int k = j + cols()*i;
+      CPoint n = surface_normal(dv_[k], du_[k]);
+      if (n.x*n.x + n.y*n.y + n.z*n.z < 1e-18) {
+        // A collapsed edge, where one derivative vanishes. The normal there
+        // is the limit from just inside the patch.
+        CPoint du, dv;
+        derivatives<M, N>(coords_, 0.5 + 0.999*(u_at(i) - 0.5), 0.5 + 0.999*(v_at(j) - 0.5), du, dv);
+        n = surface_normal(dv, du);
+      }
+      normals_[k] = n.unit();
+    }
+  }
+  stale_[0] = stale_[1] = stale_[2] = stale_[3] = 0;
+  return normals_;
+}
+
+namespace {
+  // out[i] = sum over k < K of w[k] rows[k stride + i], for i in [i, n).
+  // Every step of the evaluation is one of these, with K the number of
+  // control points along the direction being summed.
+  typedef void (*CombineFn)(const double *, std::size_t, const double *, double *, std::size_t, std::size_t);
+
+  template <int K>
+  struct Sum {
+    static double at(const double *rows, std::size_t stride, const double *w, std::size_t i) {
+      return Sum<K - 1>::at(rows, stride, w, i) + w[K - 1]*rows[(K - 1)*stride + i];
+    }
+  };
+
+  template <>
+  struct Sum<1> {
+    static double at(const double *rows, std::size_t, const double *w, std::size_t i) {
+      return w[0]*rows[i];
+    }
+  };
+
+  template <int K>
+  void combine_scalar(const double *rows, std::size_t stride, const double *w, double *out,
+                      std::size_t i, std::size_t n) {
+    for (; i < n; i++) {
+      out[i] = Sum<K>::at(rows, stride, w, i);
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  template <int K>
+  struct Avx2Sum {
+    __attribute__((target("avx2,fma")))
+    static inline __m256d at(const double *rows, std::size_t stride, const __m256d *w, std::size_t i) {
+      return _mm256_fmadd_pd(w[K - 1], _mm256_loadu_pd(rows + (K - 1)*stride + i), Avx2Sum<K - 1>::at(rows, stride, w, i));
+    }
+  };
+
+  template <>
+  struct Avx2Sum<1> {
+    __attribute__((target("avx2,fma")))
+    static inline __m256d at(const double *rows, std::size_t, const __m256d *w, std::size_t i) {
+      return _mm256_mul_pd(w[0], _mm256_loadu_pd(rows + i));
+    }
+  };
+
+  // Four samples per instruction
+  template <int K>
+  __attribute__((target("avx2,fma")))
+  void combine_avx2(const double *rows, std::size_t stride, const double *w, double *out,
+                    std::size_t i, std::size_t n) {
+    __m256d weights[K];
+    for (int k = 0; k < K; k++) {
+      weights[k] = _mm256_set1_pd(w[k]);
+    }
+    for (; i + 4 <= n; i += 4) {
+      _mm256_storeu_pd(out + i, Avx2Sum<K>::at(rows, stride, weights, i));
+    }
+    // The tail stays in here rather than calling combine_scalar, which isn't
+    // VEX encoded and would pay the AVX to SSE switch on every row
+    for (; i < n; i++) {
+      out[i] = Sum<K>::at(rows, stride, w, i);
+    }
+  }
+#endif
+
+  struct Isa {
+    const char *name;
+    bool avx2;
+  };
+
+  const Isa& best_isa() {
+    static const Isa isa = [] {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa{"avx2", true};
+      }
+#endif
+      return Isa{"scalar", false};
+    }();
+    return isa;
+  }
+
+  template <int K>
+  CombineFn combine_fn(bool simd) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (simd && best_isa().avx2) {
+      return combine_avx2<K>;
+    }
+#endif
+    return combine_scalar<K>;
+  }
+}
+
+const char* patch_isa() {
+  return best_isa().name;
+}
+
+// S(u, v) = B(u) G B(v)^T for each coordinate's control grid G, done as
+// T = G B^T first so every sample costs M+1 multiply-adds. The derivatives
+// along u and v come out of the same T and G dB^T.
+template <int M, int N>
+void BezierPatch<M, N>::update() {
+  if (!dirty_) {
+    return;
+  }
+  PROFILE_SCOPE("Patch::update");
+  std::size_t nu = rows(), nv = cols();
+  CombineFn along_u = combine_fn<kRows>(simd_), along_v = combine_fn<kCols>(simd_);
+  samples_.resize(nu*nv);
+  du_.resize(nu*nv);
+  dv_.resize(nu*nv);
+  std::vector<double> t(kRows*nv), dt(kRows*nv);
+  double CPoint::*coords[] = {&CPoint::x, &CPoint::y, &CPoint::z};
+  std::vector<double> Soa::*outputs[] = {&Soa::x, &Soa::y, &Soa::z};
+  for (int c = 0; c < 3; c++) {
+    for (std::size_t i = 0; i < kRows; i++) {
+      double g[kCols];
+      for (int j = 0; j < kCols; j++) {
+        g[j] = coords_[j + kCols*i].*coords[c];
+      }
+      along_v(&bv_[0], nv, g, &t[nv*i], 0, nv);
+      along_v(&dbv_[0], nv, g, &dt[nv*i], 0, nv);
+    }
+    double *p = &(samples_.*outputs[c])[0], *su = &(du_.*outputs[c])[0], *sv = &(dv_.*outputs[c])[0];
+    for (std::size_t u = 0; u < nu; u++) {
+      along_u(&t[0], nv, &bu_[kRows*u], p + nv*u, 0, nv);
+      along_u(&t[0], nv, &dbu_[kRows*u], su + nv*u, 0, nv);
+      along_u(&dt[0], nv, &bu_[kRows*u], sv + nv*u, 0, nv);
+    }
+  }
+  stale_normals(0, nu, 0, nv);
+  dirty_ = false;
+  interleaved_ = false;
+  evaluations_++;
+}
+
+// Grows the stale region to cover rows [u0, u1) and columns [v0, v1)
+template <int M, int N>
+void BezierPatch<M, N>::stale_normals(int u0, int u1, int v0, int v1) {
+  if (stale_[0] >= stale_[1] || stale_[2] >= stale_[3]) {
+    stale_[0] = u0; stale_[1] = u1; stale_[2] = v0; stale_[3] = v1;
+    return;
+  }
+  stale_[0] = std::min(stale_[0], u0);
+  stale_[1] = std::max(stale_[1], u1);
+  stale_[2] = std::min(stale_[2], v0);
+  stale_[3] = std::max(stale_[3], v1);
+}
+
+template <int M, int N>
+void BezierPatch<M, N>::move(int i, int dim, double delta) {
+  coords_[i][dim] += delta;
+  if (adaptive_) {
+    // The hull changed, which may move the samples
+    set_params(adaptive_params(0, tolerance_, pixels_per_unit_), adaptive_params(1, tolerance_, pixels_per_unit_));
+  }
+  if (dirty_) {
+    return;
+  }
+  PROFILE_SCOPE("Patch::move");
+  int row = i / kCols, col = i % kCols, nu = rows(), nv = cols();
+  std::vector<double> Soa::*coord = dim == 0 ? &Soa::x : dim == 1 ? &Soa::y : &Soa::z;
+  double *p = &(samples_.*coord)[0], *su = &(du_.*coord)[0], *sv = &(dv_.*coord)[0];
+  const double *b = &bv_[nv*col], *db = &dbv_[nv*col];
+  // Samples where the point and its slopes have no weight don't change,
+  // and every normal depends on its own sample's derivatives alone
+  int u0 = nu, u1 = 0, v0 = nv, v1 = 0;
+  for (int u = 0; u < nu; u++) {
+    double w = delta * bu_[kRows*u + row], dw = delta * dbu_[kRows*u + row];
+    if (w == 0 && dw == 0) {
+      continue;
+    }
+    u0 = std::min(u0, u);
+    u1 = u + 1;
+    for (int v = 0; v < nv; v++) {
+      p[v + nv*u] += w * b[v];
+      su[v + nv*u] += dw * b[v];
+      sv[v + nv*u] += w * db[v];
+    }
+  }
+  for (int v = 0; v < nv; v++) {
+    if (b[v] != 0 || db[v] != 0) {
+      v0 = std::min(v0, v);
+      v1 = v + 1;
+    }
+  }
+  if (u0 < u1 && v0 < v1) {
+    stale_normals(u0, u1, v0, v1);
+  }
+  interleaved_ = false;
+}
+
+PatchBase::CPoint& PatchBase::CPoint::operator+=(const CPoint& pt) {
   x += pt.x;
   y += pt.y;
   z += pt.z;
   return *this;
 }
 
-Patch::CPoint Patch::CPoint::operator/(double d) {
+PatchBase::CPoint PatchBase::CPoint::operator/(double d) {
   return CPoint(x/d, y/d, z/d);
 }
 
-std::ostream& operator<<(std::ostream& os, const Patch::CPoint& c) {
+std::ostream& operator<<(std::ostream& os, const PatchBase::CPoint& c) {
   return os << "(" << c.x << "," << c.y << "," << c.z << ")";
 }
+
+// The bicubic viewer patch, plus the degrees the benchmarks compare it with
+template class BezierPatch<1, 1>;
+template class BezierPatch<2, 2>;
+template class BezierPatch<3, 3>;
+template class BezierPatch<5, 5>;
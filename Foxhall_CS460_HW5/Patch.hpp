@@ -1,10 +1,14 @@
 #ifndef PATCH_HPP_
 #define PATCH_HPP_
 
+#include <array>
+#include <cstddef>
+#include <iosfwd>
 #include <vector>
 #include <OpenGL/gl.h>
 
-class Patch {
+// What patches of every degree share: the point type and how samples are kept
+class PatchBase {
 public:
   struct CPoint {
     double x, y, z;
@@ -19,16 +23,103 @@ public:
       x{x}, y{y}, z{z} {}
   };
 
-  Patch();
+  // Coordinates in separate arrays, so evaluation runs over contiguous samples
+  struct Soa {
+    std::vector<double> x, y, z;
+    std::size_t size() const { return x.size(); }
+    void resize(std::size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+    CPoint operator[](std::size_t i) const { return CPoint(x[i], y[i], z[i]); }
+    void set(std::size_t i, const CPoint& p) { x[i] = p.x; y[i] = p.y; z[i] = p.z; }
+  };
+};
+
+// A Bezier patch of degree M along u and N along v, with (M+1) x (N+1)
+// control points stored row by row along u. The degrees are template
+// arguments so every loop over them unrolls; Patch.cpp instantiates the
+// ones in use.
+template <int M, int N>
+class BezierPatch: public PatchBase {
+  static_assert(M >= 1 && N >= 1, "a patch needs at least two control points each way");
+public:
+  static const int kRows = M + 1, kCols = N + 1;
+
+  BezierPatch();
 
   void draw(double, double, double);
   void shade(double, double, double, double, GLfloat);
+  // Handing out a writable point marks the surface for re-evaluation
   CPoint& operator[](int);
+  const CPoint& operator[](int) const;
+  // Moves coordinate dim of control point i by delta. The surface is linear
+  // in every control point, so cached samples and derivatives get delta
+  // times that point's basis weight added rather than being evaluated again.
+  void move(int i, int dim, double delta);
+  // Evenly spaced samples along each side, both edges included
+  void set_resolution(int samples);
+  void set_resolution(int rows, int cols);
+  // Spaces samples by the control hull instead, so the quads stay within
+  // `tolerance` pixels of the surface with a model unit covering
+  // `pixels_per_unit` pixels on screen. An interval of u or v is halved
+  // until the hull over it bends by less than half the tolerance.
+  void set_adaptive(double tolerance, double pixels_per_unit);
+  bool adaptive() const { return adaptive_; }
+  // How many samples set_adaptive would place along u (axis 0) or v (axis 1)
+  int adaptive_samples(int axis, double tolerance, double pixels_per_unit) const;
+  // Samples along u (rows) and v (columns)
+  int rows() const { return static_cast<int>(us_.size()); }
+  int cols() const { return static_cast<int>(vs_.size()); }
+  int triangle_count() const { return 2*(rows() - 1)*(cols() - 1); }
+  // Where row i and column j sit in parameter space
+  double u_at(int i) const { return us_[i]; }
+  double v_at(int j) const { return vs_[j]; }
+  // The surface at (u, v) in [0, 1]^2, straight from the control points
+  CPoint evaluate(double u, double v) const;
+  // Surface samples and their normals, row by row along u, re-evaluated
+  // only when a control point may have changed since the last call
+  const Soa& samples();
+  const std::vector<CPoint>& normals();
+  // The same samples as whole points
+  const std::vector<CPoint>& points();
+  // Evaluates with AVX2 when the CPU has it, unless simd is false
+  void set_simd(bool simd);
+  // How often the surface has been evaluated so far
+  long evaluations() const { return evaluations_; }
+  // Whether the next points() will evaluate the surface again
+  bool dirty() const { return dirty_; }
 private:
-  Patch::CPoint bezier_param(double, double);
-  static double bernstein4(int, double);
+  // Overwrites samples along shared edges after evaluating
+  friend class PatchMesh;
+
+  void set_params(const std::vector<double>& us, const std::vector<double>& vs);
+  std::vector<double> adaptive_params(int axis, double tolerance, double pixels_per_unit) const;
+  void update();
+  void stale_normals(int u0, int u1, int v0, int v1);
 
-  std::vector<CPoint> coords_;
+  std::array<CPoint, kRows*kCols> coords_;
+  // Sample parameters and the Bernstein weights and slopes at each. M+1
+  // apiece along u; along v, one row of every column's weight per
+  // polynomial, which is how the evaluation reads them.
+  std::vector<double> us_, vs_;
+  std::vector<double> bu_, bv_, dbu_, dbv_;
+  bool adaptive_;
+  double tolerance_, pixels_per_unit_;
+  // Derivatives along u and v at each sample, which the normals come from
+  Soa samples_, du_, dv_;
+  std::vector<CPoint> points_, normals_;
+  bool dirty_;
+  // Whether points_ holds what's in samples_
+  bool interleaved_;
+  bool simd_;
+  // Rows [u0, u1) by columns [v0, v1) whose normals are out of date, only
+  // brought up to date when normals() is called
+  int stale_[4];
+  long evaluations_;
 };
 
+// The bicubic patch the viewer edits
+typedef BezierPatch<3, 3> Patch;
+
+// Which path set_simd(true) takes on this machine
+const char* patch_isa();
+
 #endif
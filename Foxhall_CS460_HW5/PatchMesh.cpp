@@ -0,0 +1,375 @@
+#include "PatchMesh.hpp"
+#include "Profiler.hpp"
+
+#include <OpenGL/gl.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <math.h>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+namespace {
+  // Control point slots along each edge: u = 0, u = 1, v = 0, v = 1
+  const int kEdgeSlots[4][4] = {
+    {0, 1, 2, 3}, {12, 13, 14, 15}, {0, 4, 8, 12}, {3, 7, 11, 15},
+  };
+
+  // Which of u (0) or v (1) runs along an edge
+  inline int edge_axis(int edge) {
+    return edge < 2 ? 1 : 0;
+  }
+
+  inline int edge_length(const Patch& p, int edge) {
+    return edge < 2 ? p.cols() : p.rows();
+  }
+
+  // Grid index of sample s along an edge
+  inline int edge_sample(const Patch& p, int edge, int s) {
+    switch (edge) {
+      case 0:
+        return s;
+      case 1:
+        return s + p.cols()*(p.rows() - 1);
+      case 2:
+        return p.cols()*s;
+      default:
+        return p.cols() - 1 + p.cols()*s;
+    }
+  }
+
+  inline double distance(const Patch::CPoint& a, const Patch::CPoint& b) {
+    return sqrt((a.x - b.x)*(a.x - b.x) + (a.y - b.y)*(a.y - b.y) + (a.z - b.z)*(a.z - b.z));
+  }
+
+  int find(std::vector<int>& parent, int i) {
+    while (parent[i] != i) {
+      i = parent[i] = parent[parent[i]];
+    }
+    return i;
+  }
+}
+
+PatchMesh PatchMesh::load(const std::string& filename, unsigned threads) {
+  std::ifstream file(filename);
+  if (!file) {
+    throw std::runtime_error("Couldn't open " + filename);
+  }
+  std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::replace(text.begin(), text.end(), ',', ' ');
+  std::istringstream in(text);
+
+  int count;
+  if (!(in >> count) || count < 0) {
+    throw std::runtime_error(filename + ": expected a patch count");
+  }
+  std::vector<std::array<int, 16>> patches(count);
+  for (auto& patch: patches) {
+    for (auto& index: patch) {
+      if (!(in >> index)) {
+        throw std::runtime_error(filename + ": expected 16 vertex indices per patch");
+      }
+      index--;
+    }
+  }
+  if (!(in >> count) || count < 0) {
+    throw std::runtime_error(filename + ": expected a vertex count");
+  }
+  std::vector<Patch::CPoint> vertices(count);
+  for (auto& v: vertices) {
+    if (!(in >> v.x >> v.y >> v.z)) {
+      throw std::runtime_error(filename + ": expected three coordinates per vertex");
+    }
+  }
+  return PatchMesh(vertices, patches, threads);
+}
+
+PatchMesh::PatchMesh(const std::vector<Patch::CPoint>& vertices, const std::vector<std::array<int, 16>>& patches,
+                     unsigned threads):
+  regroup_{true}, pool_{new ThreadPool(threads)}, adaptive_{false}, tolerance_{0}, pixels_per_unit_{0},
+  moved_{true} {
+  std::map<std::tuple<double, double, double>, int> welded;
+  std::vector<int> remap;
+  for (auto& v: vertices) {
+    auto at = welded.insert({std::make_tuple(v.x, v.y, v.z), static_cast<int>(vertices_.size())});
+    if (at.second) {
+      vertices_.push_back(v);
+    }
+    remap.push_back(at.first->second);
+  }
+
+  uses_.resize(vertices_.size());
+  for (auto& patch: patches) {
+    std::array<int, 16> indices;
+    patches_.push_back(Patch{});
+    for (int k = 0; k < 16; k++) {
+      if (patch[k] < 0 || patch[k] >= static_cast<int>(remap.size())) {
+        throw std::runtime_error("Patch vertex index out of range");
+      }
+      indices[k] = remap[patch[k]];
+      patches_.back()[k] = vertices_[indices[k]];
+      uses_[indices[k]].push_back({static_cast<int>(indices_.size()), k});
+    }
+    indices_.push_back(indices);
+  }
+  raw_normals_.resize(patches_.size());
+  find_seams();
+}
+
+// Two edges meet if they run through the same control points, either way
+// round. Collapsed edges, like the teapot's lid and bottom poles, are left
+// alone.
+void PatchMesh::find_seams() {
+  std::vector<std::array<int, 4>> edges;
+  for (auto& indices: indices_) {
+    for (auto& slots: kEdgeSlots) {
+      edges.push_back({{indices[slots[0]], indices[slots[1]], indices[slots[2]], indices[slots[3]]}});
+    }
+  }
+  for (std::size_t e = 0; e < edges.size(); e++) {
+    auto& a = edges[e];
+    if (a[0] == a[1] && a[1] == a[2] && a[2] == a[3]) {
+      continue;
+    }
+    for (std::size_t f = 0; f < e; f++) {
+      auto& b = edges[f];
+      bool same = a == b, reversed = a[0] == b[3] && a[1] == b[2] && a[2] == b[1] && a[3] == b[0];
+      if (same || reversed) {
+        seams_.push_back(Seam{static_cast<int>(f / 4), static_cast<int>(f % 4),
+                              static_cast<int>(e / 4), static_cast<int>(e % 4), !same});
+        break;
+      }
+    }
+  }
+}
+
+void PatchMesh::move(int v, int dim, double delta) {
+  vertices_[v][dim] += delta;
+  for (auto& use: uses_[v]) {
+    patches_[use.first][use.second][dim] += delta;
+  }
+  moved_ = true;
+}
+
+void PatchMesh::set_resolution(int samples) {
+  adaptive_ = false;
+  regroup_ = true;
+  for (auto& patch: patches_) {
+    patch.set_resolution(samples);
+  }
+}
+
+void PatchMesh::set_adaptive(double tolerance, double pixels_per_unit) {
+  if (adaptive_ && !moved_ && tolerance == tolerance_ && pixels_per_unit == pixels_per_unit_) {
+    return;
+  }
+  adaptive_ = true;
+  tolerance_ = tolerance;
+  pixels_per_unit_ = pixels_per_unit;
+  moved_ = false;
+  std::vector<int> counts(2*patches_.size());
+  pool_->run(counts.size(), [&](std::size_t i) {
+    counts[i] = patches_[i / 2].adaptive_samples(i % 2, tolerance, pixels_per_unit);
+  });
+  harmonize(counts);
+}
+
+// Patches on either side of a seam have to agree on the samples along it,
+// and a count along u is shared by both of a patch's u edges, so whole
+// chains of patches end up with the largest count any of them asked for
+void PatchMesh::harmonize(std::vector<int> counts) {
+  regroup_ = true;
+  std::vector<int> parent(counts.size());
+  for (std::size_t i = 0; i < parent.size(); i++) {
+    parent[i] = static_cast<int>(i);
+  }
+  for (auto& seam: seams_) {
+    int a = find(parent, 2*seam.owner + edge_axis(seam.owner_edge));
+    int b = find(parent, 2*seam.other + edge_axis(seam.other_edge));
+    parent[a] = b;
+    counts[b] = std::max(counts[a], counts[b]);
+  }
+  for (std::size_t p = 0; p < patches_.size(); p++) {
+    patches_[p].set_resolution(counts[find(parent, 2*p)], counts[find(parent, 2*p + 1)]);
+  }
+}
+
+void PatchMesh::update() {
+  std::vector<int> dirty;
+  for (std::size_t p = 0; p < patches_.size(); p++) {
+    if (patches_[p].dirty()) {
+      dirty.push_back(static_cast<int>(p));
+    }
+  }
+  if (dirty.empty()) {
+    return;
+  }
+  PROFILE_SCOPE("PatchMesh::update");
+  pool_->run(dirty.size(), [&](std::size_t i) {
+    raw_normals_[dirty[i]] = patches_[dirty[i]].normals();
+  });
+  if (regroup_) {
+    group_samples();
+  }
+  // Every patch sharing a sample takes the lead patch's point and the
+  // average of all their own normals, so repeated updates and corners
+  // where several patches meet come out the same
+  std::vector<int> groups;
+  for (int p: dirty) {
+    groups.insert(groups.end(), patch_groups_[p].begin(), patch_groups_[p].end());
+  }
+  std::sort(groups.begin(), groups.end());
+  groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+  for (int g: groups) {
+    auto begin = shared_.begin() + group_start_[g], end = shared_.begin() + group_start_[g + 1];
+    Patch::CPoint point = patches_[begin->first].samples_[begin->second], normal;
+    for (auto s = begin; s != end; ++s) {
+      normal += raw_normals_[s->first][s->second];
+    }
+    bool degenerate = normal.x*normal.x + normal.y*normal.y + normal.z*normal.z <= 1e-12;
+    for (auto s = begin; s != end; ++s) {
+      Patch& patch = patches_[s->first];
+      if (s != begin) {
+        patch.samples_.set(s->second, point);
+        patch.interleaved_ = false;
+      }
+      patch.normals_[s->second] = degenerate ? raw_normals_[s->first][s->second] : normal.unit();
+    }
+  }
+}
+
+// Joins the samples along every seam, through corners where more than two
+// patches meet, into groups led by the lowest patch
+void PatchMesh::group_samples() {
+  regroup_ = false;
+  std::vector<int> first(patches_.size() + 1);
+  for (std::size_t p = 0; p < patches_.size(); p++) {
+    first[p + 1] = first[p] + patches_[p].rows()*patches_[p].cols();
+  }
+  std::vector<int> parent(first.back());
+  for (std::size_t i = 0; i < parent.size(); i++) {
+    parent[i] = static_cast<int>(i);
+  }
+  for (auto& seam: seams_) {
+    const Patch& owner = patches_[seam.owner];
+    const Patch& other = patches_[seam.other];
+    int n = edge_length(owner, seam.owner_edge);
+    for (int s = 0; s < n; s++) {
+      int a = find(parent, first[seam.owner] + edge_sample(owner, seam.owner_edge, seam.reversed ? n - 1 - s : s));
+      int b = find(parent, first[seam.other] + edge_sample(other, seam.other_edge, s));
+      parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+  std::vector<std::pair<int, int>> members;
+  for (std::size_t i = 0; i < parent.size(); i++) {
+    int root = find(parent, static_cast<int>(i));
+    if (root != static_cast<int>(i)) {
+      members.push_back({root, static_cast<int>(i)});
+    }
+  }
+  std::sort(members.begin(), members.end());
+  auto shared = [&](int i) {
+    int p = static_cast<int>(std::upper_bound(first.begin(), first.end(), i) - first.begin()) - 1;
+    return std::make_pair(p, i - first[p]);
+  };
+  shared_.clear();
+  group_start_.clear();
+  patch_groups_.assign(patches_.size(), {});
+  for (std::size_t m = 0; m < members.size(); m++) {
+    if (m == 0 || members[m].first != members[m - 1].first) {
+      group_start_.push_back(static_cast<int>(shared_.size()));
+      shared_.push_back(shared(members[m].first));
+    }
+    shared_.push_back(shared(members[m].second));
+  }
+  group_start_.push_back(static_cast<int>(shared_.size()));
+  for (std::size_t g = 0; g + 1 < group_start_.size(); g++) {
+    for (int s = group_start_[g]; s < group_start_[g + 1]; s++) {
+      auto& groups = patch_groups_[shared_[s].first];
+      if (groups.empty() || groups.back() != static_cast<int>(g)) {
+        groups.push_back(static_cast<int>(g));
+      }
+    }
+  }
+}
+
+double PatchMesh::seam_gap(bool stored) const {
+  double gap = 0;
+  for (auto& seam: seams_) {
+    const Patch& owner = patches_[seam.owner];
+    const Patch& other = patches_[seam.other];
+    int n = edge_length(owner, seam.owner_edge);
+    for (int s = 0; s < n; s++) {
+      int a = edge_sample(owner, seam.owner_edge, seam.reversed ? n - 1 - s : s);
+      int b = edge_sample(other, seam.other_edge, s);
+      if (stored) {
+        gap = std::max(gap, distance(owner.samples_[a], other.samples_[b]));
+      } else {
+        auto p = owner.evaluate(owner.u_at(a / owner.cols()), owner.v_at(a % owner.cols()));
+        auto q = other.evaluate(other.u_at(b / other.cols()), other.v_at(b % other.cols()));
+        gap = std::max(gap, distance(p, q));
+      }
+    }
+  }
+  return gap;
+}
+
+double PatchMesh::seam_normal_gap() const {
+  double gap = 0;
+  for (std::size_t g = 0; g + 1 < group_start_.size(); g++) {
+    auto& lead = shared_[group_start_[g]];
+    for (int s = group_start_[g] + 1; s < group_start_[g + 1]; s++) {
+      gap = std::max(gap, distance(patches_[lead.first].normals_[lead.second],
+                                   patches_[shared_[s].first].normals_[shared_[s].second]));
+    }
+  }
+  return gap;
+}
+
+int PatchMesh::triangle_count() const {
+  int count = 0;
+  for (auto& patch: patches_) {
+    count += patch.triangle_count();
+  }
+  return count;
+}
+
+long PatchMesh::evaluations() const {
+  long count = 0;
+  for (auto& patch: patches_) {
+    count += patch.evaluations();
+  }
+  return count;
+}
+
+void PatchMesh::draw(bool shaded) {
+  PROFILE_SCOPE("PatchMesh::draw");
+  update();
+  glPolygonMode(GL_FRONT_AND_BACK, shaded ? GL_FILL : GL_LINE);
+  if (shaded) {
+    glColor3f(0.0, 0.5, 1.0);
+  } else {
+    glColor3f(0.0, 1.0, 0.0);
+  }
+  for (auto& patch: patches_) {
+    const Patch::Soa& pts = patch.samples_;
+    const std::vector<Patch::CPoint>& norms = patch.normals_;
+    int n = patch.cols();
+    for (int i = 0; i < patch.rows() - 1; i++) {
+      glBegin(GL_TRIANGLE_STRIP);
+      for (int j = 0; j < n; j++) {
+        for (int k: {j + n*i, j + n*(i+1)}) {
+          if (shaded) {
+            glNormal3f(norms[k].x, norms[k].y, norms[k].z);
+          }
+          glVertex3f(pts.x[k], pts.y[k], pts.z[k]);
+        }
+      }
+      glEnd();
+    }
+  }
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
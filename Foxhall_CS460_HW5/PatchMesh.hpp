@@ -0,0 +1,82 @@
+#ifndef PATCH_MESH_HPP_
+#define PATCH_MESH_HPP_
+
+#include "Patch.hpp"
+#include "ThreadPool.hpp"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Bicubic patches sharing control points, like the Utah teapot. Patches
+// are evaluated in parallel and only when their control points moved.
+// Where two patches meet, the one listed first owns the edge and the
+// other takes its samples, so the surface has no cracks.
+class PatchMesh {
+public:
+  // Newell's teapot layout: the number of patches, one line of 16 comma
+  // separated, 1-based vertex indices per patch (four rows of four), the
+  // number of vertices, then an "x, y, z" line per vertex
+  static PatchMesh load(const std::string& filename, unsigned threads = 0);
+  // Vertices in the same spot are merged, so moving one moves them all
+  PatchMesh(const std::vector<Patch::CPoint>& vertices, const std::vector<std::array<int, 16>>& patches,
+            unsigned threads = 0);
+
+  void draw(bool shaded);
+  std::size_t size() const { return patches_.size(); }
+  const Patch& patch(std::size_t i) const { return patches_[i]; }
+  // Patch i's normals as drawn, the same on every side of a seam
+  const std::vector<Patch::CPoint>& normals(std::size_t i) const { return patches_[i].normals_; }
+  const std::vector<Patch::CPoint>& vertices() const { return vertices_; }
+  unsigned threads() const { return pool_->size(); }
+  // Moves coordinate dim of vertex v in every patch that uses it
+  void move(int v, int dim, double delta);
+  // Every patch gets the same count, or the most any patch along a chain
+  // of shared edges wants for the tolerance, spaced evenly
+  void set_resolution(int samples);
+  void set_adaptive(double tolerance, double pixels_per_unit);
+  // Evaluates and stitches whatever changed since the last call
+  void update();
+  int triangle_count() const;
+  long evaluations() const;
+  // Widest gap between samples two patches share, as stored or as each
+  // patch evaluates them on its own
+  double seam_gap(bool stored = true) const;
+  // Widest difference between the normals patches give a sample they share
+  double seam_normal_gap() const;
+private:
+  struct Seam {
+    int owner, owner_edge, other, other_edge;
+    bool reversed;
+  };
+
+  void find_seams();
+  void harmonize(std::vector<int> counts);
+  void group_samples();
+
+  std::vector<Patch::CPoint> vertices_;
+  std::vector<std::array<int, 16>> indices_;
+  std::vector<Patch> patches_;
+  std::vector<Seam> seams_;
+  // Samples that are the same point of the surface, as (patch, sample)
+  // pairs, group g running from group_start_[g] to group_start_[g + 1].
+  // Each group leads with the earliest patch, which nothing overwrites.
+  std::vector<std::pair<int, int>> shared_;
+  std::vector<int> group_start_;
+  // The groups each patch has a sample in
+  std::vector<std::vector<int>> patch_groups_;
+  // Whether sample counts changed since the groups were made
+  bool regroup_;
+  // Each patch's normals before averaging across seams
+  std::vector<std::vector<Patch::CPoint>> raw_normals_;
+  // Patch and control point slot for every use of a vertex
+  std::vector<std::vector<std::pair<int, int>>> uses_;
+  std::unique_ptr<ThreadPool> pool_;
+  bool adaptive_;
+  double tolerance_, pixels_per_unit_;
+  // Control points moved since the samples were last placed
+  bool moved_;
+};
+
+#endif
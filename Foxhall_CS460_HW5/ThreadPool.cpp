@@ -0,0 +1,72 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads): job_{nullptr}, count_{0}, next_{0}, busy_{0}, generation_{0},
+                                          stopping_{false} {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned i = 1; i < threads; i++) {
+    workers_.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto& w: workers_) {
+    w.join();
+  }
+}
+
+void ThreadPool::run(std::size_t n, const std::function<void(std::size_t)>& job) {
+  if (workers_.empty() || n < 2) {
+    for (std::size_t i = 0; i < n; i++) {
+      job(i);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = &job;
+    count_ = n;
+    next_ = 0;
+    busy_ = static_cast<unsigned>(workers_.size());
+    generation_++;
+  }
+  wake_.notify_all();
+  drain();
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return busy_ == 0; });
+  job_ = nullptr;
+}
+
+// Indices go to whoever asks next, so a slow one doesn't hold up the rest
+void ThreadPool::drain() {
+  for (std::size_t i = next_++; i < count_; i = next_++) {
+    (*job_)(i);
+  }
+}
+
+void ThreadPool::work() {
+  long seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_) {
+        return;
+      }
+      seen = generation_;
+    }
+    drain();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--busy_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that sleep between runs, so handing out per-frame
+// work costs a wake-up rather than a thread start
+class ThreadPool {
+public:
+  // 0 means one thread per core. The caller counts as one of them.
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  unsigned size() const { return static_cast<unsigned>(workers_.size()) + 1; }
+  // Calls job(i) for every i in [0, n), spread over the pool and the
+  // calling thread, and returns once they're all done
+  void run(std::size_t n, const std::function<void(std::size_t)>& job);
+private:
+  void work();
+  void drain();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  const std::function<void(std::size_t)> *job_;
+  std::size_t count_;
+  std::atomic<std::size_t> next_;
+  // Workers still on the current run
+  unsigned busy_;
+  long generation_;
+  bool stopping_;
+};
+
+#endif
@@ -1,15 +1,27 @@
+#include "Bench.hpp"
 #include "Patch.hpp"
+#include "PatchMesh.hpp"
+#include "Profiler.hpp"
+#include "Replay.hpp"
 
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
 #include <GLUT/glut.h>
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <assert.h>
 #include <math.h>
+#include <string>
 
 namespace {
   Patch bezier;
+  // A patch set from the command line, drawn instead of the single patch
+  // and scaled to about the same size
+  std::unique_ptr<PatchMesh> mesh;
+  double mesh_scale;
   int position;
   int dim;
   bool is_shaded;
@@ -19,6 +31,10 @@ namespace {
   GLfloat LightPosition[] = { 50.0, 50.0, 50.0, 0.0 };
   double shininess;
   GLfloat diffuse;
+  // Samples per side when uniform, pixels of error allowed when adaptive
+  int samples;
+  double tolerance;
+  bool adaptive;
 }
 
 void init() {
@@ -32,9 +48,14 @@ void init() {
   is_shaded = false;
   shininess = 50.0;
   diffuse = 0.7;
+  samples = 20;
+  tolerance = 1.0;
+  adaptive = false;
 }
 
 void display() {
+  PROFILE_FRAME();
+  PROFILE_SCOPE("display");
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // Set projection mode
@@ -59,10 +80,26 @@ void display() {
   glVertex3f(0.0, 0.0, 0.0);
   glVertex3f(0.0, 0.0, 100.0);
   glEnd();
-  if (is_shaded) {
-    bezier.shade(45, 45, position, shininess, diffuse);
+  // Pixels per model unit at the origin, for the 60 degree field of view
+  double dist = sqrt(45.0*45.0 + 45.0*45.0 + position*position);
+  double ppu = glutGet(GLUT_WINDOW_HEIGHT) / (2*dist*tan(M_PI / 6));
+  if (mesh) {
+    if (adaptive) {
+      mesh->set_adaptive(tolerance, ppu*mesh_scale);
+    }
+    glPushMatrix();
+    glScaled(mesh_scale, mesh_scale, mesh_scale);
+    mesh->draw(is_shaded);
+    glPopMatrix();
   } else {
-    bezier.draw(45, 45, position);
+    if (adaptive) {
+      bezier.set_adaptive(tolerance, ppu);
+    }
+    if (is_shaded) {
+      bezier.shade(45, 45, position, shininess, diffuse);
+    } else {
+      bezier.draw(45, 45, position);
+    }
   }
 
   glFlush();
@@ -78,6 +115,13 @@ void reshape(int w, int h) {
   glLoadIdentity();
 }
 
+void set_resolution() {
+  bezier.set_resolution(samples);
+  if (mesh) {
+    mesh->set_resolution(samples);
+  }
+}
+
 void keyboard_handler(unsigned char key, int, int) {
   switch (key) {
   case 27: // ESC
@@ -90,32 +134,54 @@ void keyboard_handler(unsigned char key, int, int) {
     position += 10;
     break;
   case 'q':
-    bezier[5][dim] += 5.0;
+    bezier.move(5, dim, 5.0);
     break;
   case 'a':
-    bezier[5][dim] -= 5.0;
+    bezier.move(5, dim, -5.0);
     break;
   case 'w':
-    bezier[6][dim] += 5.0;
+    bezier.move(6, dim, 5.0);
     break;
   case 's':
-    bezier[6][dim] -= 5.0;
+    bezier.move(6, dim, -5.0);
     break;
   case 'e':
-    bezier[9][dim] += 5.0;
+    bezier.move(9, dim, 5.0);
     break;
   case 'd':
-    bezier[9][dim] -= 5.0;
+    bezier.move(9, dim, -5.0);
     break;
   case 'r':
-    bezier[10][dim] += 5.0;
+    bezier.move(10, dim, 5.0);
     break;
   case 'f':
-    bezier[10][dim] -= 5.0;
+    bezier.move(10, dim, -5.0);
     break;
   case ' ':
     dim = (dim + 1) % 3;
     break;
+  case 't':
+    adaptive = !adaptive;
+    if (!adaptive) {
+      set_resolution();
+    }
+    break;
+  case 'u':
+    if (adaptive) {
+      tolerance /= 2;
+    } else {
+      samples += 5;
+      set_resolution();
+    }
+    break;
+  case 'j':
+    if (adaptive) {
+      tolerance *= 2;
+    } else {
+      samples = std::max(2, samples - 5);
+      set_resolution();
+    }
+    break;
   case '.':
     is_shaded = !is_shaded;
     if (is_shaded) {
@@ -169,6 +235,24 @@ void keyboard_handler(unsigned char key, int, int) {
 
 
 int main(int argc, char *argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    return run_bench(argc - 2, argv + 2);
+  }
+
+  if (argc > 1) {
+    try {
+      mesh.reset(new PatchMesh(PatchMesh::load(argv[1])));
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    double extent = 0;
+    for (auto& v: mesh->vertices()) {
+      extent = std::max({extent, fabs(v.x), fabs(v.y), fabs(v.z)});
+    }
+    mesh_scale = extent > 0 ? 30 / extent : 1;
+  }
+
   glutInit(&argc, argv);
   //Set Display Mode
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
@@ -179,11 +263,12 @@ int main(int argc, char *argv[]) {
   //Create the window
   glutCreateWindow("CS 460");
   init();
+  replay::init();
 
-  glutDisplayFunc(display);
-  glutIdleFunc(display);
+  replay::display_func(display);
+  replay::idle_func(display);
   glutReshapeFunc(reshape);
-  glutKeyboardFunc(keyboard_handler);
+  replay::keyboard_func(keyboard_handler);
 
   //Enter the GLUT event loop
   glutMainLoop();
@@ -0,0 +1,195 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+/*
+  Scope timers for finding out where frame time goes.
+
+  Build with `make clean && make PROFILE=1` to turn them on, otherwise
+  PROFILE_SCOPE and PROFILE_FRAME expand to nothing.
+
+  PROFILE_SCOPE("name")  times the rest of the enclosing block
+  PROFILE_FRAME()        marks a frame boundary, call it first thing in
+                         display(). Every PROFILE_EVERY frames (default 120)
+                         p50/p99 of each scope over that window are printed
+                         to stdout
+
+  Timings go into a fixed size lock-free ring buffer, so only the most recent
+  events are kept. If PROFILE_TRACE is set in the environment they are
+  written there on exit as Chrome trace-event JSON (open in chrome://tracing).
+*/
+
+#ifdef PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+struct Event {
+  const char *name;
+  uint32_t tid;
+  uint64_t start_ns;
+  uint64_t dur_ns;
+};
+
+const std::size_t kCapacity = 1 << 16;
+
+// Writers claim a slot with one fetch_add. seq is published last so a reader
+// can tell a finished slot from one that is being overwritten.
+struct Ring {
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    Event event;
+  };
+  Slot slots[kCapacity];
+  std::atomic<uint64_t> head;
+};
+
+inline Ring& ring() {
+  static Ring* r = new Ring();
+  return *r;
+}
+
+inline uint64_t now_ns() {
+  static const auto epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - epoch).count();
+}
+
+inline uint32_t thread_id() {
+  static std::atomic<uint32_t> next{0};
+  thread_local uint32_t id = next++;
+  return id;
+}
+
+inline void record(const char *name, uint64_t start_ns, uint64_t dur_ns) {
+  Ring& r = ring();
+  uint64_t idx = r.head.fetch_add(1, std::memory_order_relaxed);
+  Ring::Slot& s = r.slots[idx % kCapacity];
+  s.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s.event = Event{name, thread_id(), start_ns, dur_ns};
+  s.seq.store(idx + 1, std::memory_order_release);
+}
+
+// Copies out events [from, head) that are still in the buffer
+inline std::vector<Event> snapshot(uint64_t from) {
+  Ring& r = ring();
+  uint64_t head = r.head.load(std::memory_order_acquire);
+  if (head - from > kCapacity) {
+    from = head - kCapacity;
+  }
+  std::vector<Event> out;
+  out.reserve(head - from);
+  for (uint64_t idx = from; idx < head; idx++) {
+    Ring::Slot& s = r.slots[idx % kCapacity];
+    if (s.seq.load(std::memory_order_acquire) != idx + 1) {
+      continue;
+    }
+    Event e = s.event;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) == idx + 1) {
+      out.push_back(e);
+    }
+  }
+  return out;
+}
+
+inline void write_trace(const char *filename) {
+  std::ofstream out(filename);
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  for (auto& e: snapshot(0)) {
+    out << (first ? "\n" : ",\n")
+        << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+        << ",\"ts\":" << e.start_ns / 1000.0 << ",\"dur\":" << e.dur_ns / 1000.0 << "}";
+    first = false;
+  }
+  out << "\n]}\n";
+}
+
+inline void write_trace_at_exit() {
+  const char *filename = std::getenv("PROFILE_TRACE");
+  if (filename) {
+    write_trace(filename);
+    std::cout << "Wrote trace to " << filename << std::endl;
+  }
+}
+
+inline void report(uint64_t from) {
+  std::map<std::string, std::vector<uint64_t> > durations;
+  for (auto& e: snapshot(from)) {
+    durations[e.name].push_back(e.dur_ns);
+  }
+  std::cout << std::left << std::setw(24) << "scope" << std::right
+            << std::setw(8) << "count" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << "\n";
+  for (auto& it: durations) {
+    auto& d = it.second;
+    std::sort(d.begin(), d.end());
+    double p50 = d[d.size() / 2] / 1e6;
+    double p99 = d[std::min(d.size() - 1, d.size() * 99 / 100)] / 1e6;
+    std::cout << std::left << std::setw(24) << it.first << std::right
+              << std::setw(8) << d.size() << std::fixed << std::setprecision(3)
+              << std::setw(12) << p50 << std::setw(12) << p99 << "\n";
+    std::cout.unsetf(std::ios::fixed);
+  }
+  std::cout << std::endl;
+}
+
+inline void frame() {
+  static uint64_t last_frame = now_ns();
+  static uint64_t window_start = 0;
+  static int frames = 0;
+  static int every = 0;
+  if (every == 0) {
+    const char *env = std::getenv("PROFILE_EVERY");
+    every = env ? std::max(1, std::atoi(env)) : 120;
+    std::atexit(write_trace_at_exit);
+  }
+
+  uint64_t now = now_ns();
+  record("frame", last_frame, now - last_frame);
+  last_frame = now;
+
+  if (++frames == every) {
+    report(window_start);
+    window_start = ring().head.load(std::memory_order_relaxed);
+    frames = 0;
+  }
+}
+
+class Scope {
+public:
+  explicit Scope(const char *name): name_{name}, start_{now_ns()} {}
+  ~Scope() { record(name_, start_, now_ns() - start_); }
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+private:
+  const char *name_;
+  uint64_t start_;
+};
+
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__){name}
+#define PROFILE_FRAME() profiler::frame()
+
+#else
+
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_FRAME() do {} while (0)
+
+#endif
+
+#endif
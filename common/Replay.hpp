@@ -0,0 +1,240 @@
+#ifndef REPLAY_HPP_
+#define REPLAY_HPP_
+
+/*
+  Input recording and replay, so interactive runs can be repeated exactly.
+
+  Register callbacks through replay:: instead of glut*Func and call
+  replay::init() once the window exists. The environment picks the mode:
+
+  RECORD=<file>        log every input event with its time since startup
+  REPLAY=<file>        ignore live input and feed the log back instead
+  REPLAY_STEP=<ms>     virtual time per frame while replaying (default 16.667)
+  REPLAY_FAST=1        don't wait out the step, run frames back to back (empty
+                       or 0 leaves it off)
+
+  Replay is deterministic: an event recorded at t ms is handed out on frame
+  t / REPLAY_STEP no matter how fast either machine was. ESC is never
+  recorded, the program exits after the last event and prints the frame time
+  distribution.
+*/
+
+#include <GLUT/glut.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace replay {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  double t;
+  char type; // K key, S special, M mouse, D drag, P passive motion
+  int args[4];
+};
+
+struct State {
+  enum Mode { OFF, RECORD, REPLAY } mode = OFF;
+  std::ofstream out;
+  std::vector<Event> events;
+  std::size_t next = 0;
+  double step = 1000.0 / 60;
+  bool fast = false;
+  long frame = 0;
+  Clock::time_point start = Clock::now();
+  std::vector<double> frame_ms;
+
+  void (*display)() = nullptr;
+  void (*idle)() = nullptr;
+  void (*keyboard)(unsigned char, int, int) = nullptr;
+  void (*special)(int, int, int) = nullptr;
+  void (*mouse)(int, int, int, int) = nullptr;
+  void (*motion)(int, int) = nullptr;
+  void (*passive)(int, int) = nullptr;
+};
+
+inline State& state() {
+  static State s;
+  return s;
+}
+
+inline double elapsed_ms() {
+  return std::chrono::duration<double, std::milli>(Clock::now() - state().start).count();
+}
+
+inline void record_event(char type, int a, int b, int c = 0, int d = 0) {
+  State& s = state();
+  if (s.mode != State::RECORD) {
+    return;
+  }
+  s.out << std::fixed << std::setprecision(3) << elapsed_ms() << " " << s.frame << " " << type
+        << " " << a << " " << b << " " << c << " " << d << "\n";
+}
+
+inline void dispatch(const Event& e) {
+  State& s = state();
+  const int *a = e.args;
+  switch (e.type) {
+  case 'K': if (s.keyboard) s.keyboard(a[0], a[1], a[2]); break;
+  case 'S': if (s.special) s.special(a[0], a[1], a[2]); break;
+  case 'M': if (s.mouse) s.mouse(a[0], a[1], a[2], a[3]); break;
+  case 'D': if (s.motion) s.motion(a[0], a[1]); break;
+  case 'P': if (s.passive) s.passive(a[0], a[1]); break;
+  default: break;
+  }
+}
+
+inline void report() {
+  State& s = state();
+  auto& ms = s.frame_ms;
+  if (ms.empty()) {
+    return;
+  }
+  double total = 0;
+  for (double m: ms) {
+    total += m;
+  }
+  std::sort(ms.begin(), ms.end());
+  auto pct = [&](double p) { return ms[std::min(ms.size() - 1, static_cast<std::size_t>(ms.size() * p))]; };
+  std::cout << "Replayed " << s.events.size() << " events over " << ms.size() << " frames\n"
+            << std::fixed << std::setprecision(3)
+            << "frame ms  mean " << total / ms.size() << "  p50 " << pct(0.5) << "  p90 " << pct(0.9)
+            << "  p99 " << pct(0.99) << "  max " << ms.back() << std::endl;
+}
+
+// Wraps every display/idle call: feeds due events, times the frame, paces it
+inline void frame(void (*f)()) {
+  State& s = state();
+  if (s.mode != State::REPLAY) {
+    s.frame++;
+    f();
+    return;
+  }
+
+  double now = s.frame * s.step;
+  while (s.next < s.events.size() && s.events[s.next].t <= now) {
+    dispatch(s.events[s.next++]);
+  }
+
+  auto begin = Clock::now();
+  f();
+  s.frame_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - begin).count());
+  s.frame++;
+
+  if (s.next == s.events.size()) {
+    report();
+    std::exit(0);
+  }
+  if (!s.fast) {
+    auto due = s.start + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double, std::milli>(s.frame * s.step));
+    std::this_thread::sleep_until(due);
+  }
+  glutPostRedisplay();
+}
+
+inline void display_thunk() { frame(state().display); }
+inline void idle_thunk() { frame(state().idle); }
+inline void keyboard_thunk(unsigned char key, int x, int y) {
+  if (key != 27) {
+    record_event('K', key, x, y);
+  }
+  state().keyboard(key, x, y);
+}
+inline void special_thunk(int key, int x, int y) {
+  record_event('S', key, x, y);
+  state().special(key, x, y);
+}
+inline void mouse_thunk(int button, int st, int x, int y) {
+  record_event('M', button, st, x, y);
+  state().mouse(button, st, x, y);
+}
+inline void motion_thunk(int x, int y) {
+  record_event('D', x, y);
+  state().motion(x, y);
+}
+inline void passive_thunk(int x, int y) {
+  record_event('P', x, y);
+  state().passive(x, y);
+}
+
+// Live input goes nowhere while replaying
+inline bool live() { return state().mode != State::REPLAY; }
+
+inline void display_func(void (*f)()) {
+  state().display = f;
+  glutDisplayFunc(display_thunk);
+}
+inline void idle_func(void (*f)()) {
+  state().idle = f;
+  glutIdleFunc(idle_thunk);
+}
+inline void keyboard_func(void (*f)(unsigned char, int, int)) {
+  state().keyboard = f;
+  if (live()) glutKeyboardFunc(keyboard_thunk);
+}
+inline void special_func(void (*f)(int, int, int)) {
+  state().special = f;
+  if (live()) glutSpecialFunc(special_thunk);
+}
+inline void mouse_func(void (*f)(int, int, int, int)) {
+  state().mouse = f;
+  if (live()) glutMouseFunc(mouse_thunk);
+}
+inline void motion_func(void (*f)(int, int)) {
+  state().motion = f;
+  if (live()) glutMotionFunc(motion_thunk);
+}
+inline void passive_motion_func(void (*f)(int, int)) {
+  state().passive = f;
+  if (live()) glutPassiveMotionFunc(passive_thunk);
+}
+
+// Call after glutCreateWindow and before registering callbacks
+inline void init() {
+  State& s = state();
+  int w = glutGet(GLUT_WINDOW_WIDTH);
+  int h = glutGet(GLUT_WINDOW_HEIGHT);
+
+  if (const char *file = std::getenv("REPLAY")) {
+    std::ifstream in(file);
+    std::string magic;
+    int version;
+    if (!(in >> magic >> version >> w >> h) || magic != "replay" || version != 1) {
+      std::cerr << file << " is not a replay log" << std::endl;
+      std::exit(1);
+    }
+    Event e;
+    long recorded_frame;
+    while (in >> e.t >> recorded_frame >> e.type >> e.args[0] >> e.args[1] >> e.args[2] >> e.args[3]) {
+      s.events.push_back(e);
+    }
+    if (const char *step = std::getenv("REPLAY_STEP")) {
+      s.step = std::atof(step);
+    }
+    if (const char *fast = std::getenv("REPLAY_FAST")) {
+      s.fast = std::string(fast) != "" && std::string(fast) != "0";
+    }
+    s.mode = State::REPLAY;
+    glutReshapeWindow(w, h);
+    std::cout << "Replaying " << s.events.size() << " events from " << file << std::endl;
+  } else if (const char *file = std::getenv("RECORD")) {
+    s.out.open(file);
+    s.out << "replay 1 " << w << " " << h << "\n";
+    s.mode = State::RECORD;
+    std::cout << "Recording input to " << file << std::endl;
+  }
+  s.start = Clock::now();
+}
+
+}
+
+#endif